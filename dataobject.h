@@ -47,8 +47,15 @@
 //
 // dofromjson         dogetsint, ...      No special requirements
 //                                        Note that data is imported
-//                                        as either do_sint64, do_bool,
-//                                        do_string, or do_double
+//                                        as either do_sint64, do_uint64,
+//                                        do_bool, do_string, or
+//                                        do_double.  Integers come in
+//                                        as do_sint64, or do_uint64
+//                                        above INT64_MAX.  Numbers with
+//                                        a fraction or an exponent
+//                                        (e.g. 1.0 or 1e5), or which
+//                                        are too large for 64 bits,
+//                                        come in as do_double.
 // 
 // dofromjson         doasjson            No special requirements
 //
@@ -100,6 +107,28 @@ typedef struct {
 } DATAOBJECT ;
 #endif
 
+#ifndef DOPATH
+typedef struct {
+} DOPATH ;
+#endif
+
+// Iterator (see doiter_begin), which the caller allocates
+
+#define DO_ITER_SIBLINGS 0   // Visit the entries of an object / array
+#define DO_ITER_DEPTHFIRST 1 // Also visit every node beneath them
+
+#define DO_ITERDEPTH 64
+
+typedef struct DOITER {
+  DATAOBJECT *node ;                  // Current node
+  DATAOBJECT *pending ;               // Node to visit next
+  DATAOBJECT *stack[DO_ITERDEPTH] ;   // Nodes to resume from at each level
+  int depth ;                         // Levels in stack
+  int level ;                         // Depth of current node
+  int mode ;
+  int truncated ;                     // Set if nodes beyond DO_ITERDEPTH were skipped
+} DOITER ;
+
 enum dataobject_type {
   do_int32, do_int64, do_uint32, do_uint64, do_sint32, do_sint64, do_bool, do_enum,
   do_64bit, do_fixed64, do_sfixed64, do_double,
@@ -108,6 +137,22 @@ enum dataobject_type {
   do_node, do_unknown
 } ;
 
+// Entry for dosetmany / dogetmany.  The value is held in the
+// field which suits the type: u for unsigned / enum / bool and
+// fixed types, s for signed types, real for do_float / do_double,
+// and data / datalen for do_string / do_data.
+
+typedef struct dobatch_entry {
+  char *path ;                  // Path to item
+  enum dataobject_type type ;   // Record type
+  unsigned long int u ;
+  signed long int s ;
+  double real ;
+  char *data ;
+  int datalen ;
+  int ok ;                      // Set by dogetmany if the item was found
+} dobatch_entry ;
+
 
 //////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////
@@ -126,6 +171,38 @@ enum dataobject_type {
 DATAOBJECT *donew() ;
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Creates an arena backed data object.  All nodes, labels
+//        and data in the tree are allocated from chunks owned by
+//        the root.  Nothing is freed individually: doclear or
+//        dodelete on the root releases the whole tree in one go,
+//        and memory from cleared sub-trees is reclaimed then.
+// @param(in) sizehint Expected size of tree in bytes (0 for default)
+// @return pointer to DATAOBJECT, or NULL on error (errno set)
+//
+
+DATAOBJECT *donew_arena(unsigned long int sizehint) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Creates a pooled data object, for trees which are
+//        repeatedly cleared and re-populated (e.g. by dofromjson
+//        or dofromprotobuf).  Memory from cleared nodes, labels
+//        and data is kept on free lists owned by the root and
+//        re-used, and clearing the root keeps its memory for the
+//        next use, so a steady state parse does not touch the heap.
+//        Memory is returned to the system by dodelete.
+// @param(in) sizehint Expected size of tree in bytes (0 for default)
+// @return pointer to DATAOBJECT, or NULL on error (errno set)
+//
+
+DATAOBJECT *donew_pool(unsigned long int sizehint) ;
+
+
 
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
@@ -149,6 +226,37 @@ int doclear(DATAOBJECT *dh) ;
 int dodelete(DATAOBJECT *dh) ;
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Deletes a tree, deferring the work of freeing it.
+//        The tree is detached and queued, and is freed
+//        incrementally by doreclaim_step, which can be called
+//        in idle time, or from a background thread.  The handle
+//        must not be used afterwards.  A handle which is not the
+//        root of a tree is deleted immediately, as with dodelete.
+// @param(in) dh DATAOBJECT handle (root of tree)
+// @return True on success
+//
+
+int dodelete_async(DATAOBJECT *dh) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Frees some of the trees deleted with dodelete_async.
+//        This is thread safe, and bounds the time taken by
+//        freeing at most budget nodes (or, for arena and pool
+//        trees, chunks).
+// @param(in) budget Maximum number of nodes to free, or 0 to
+//            free everything waiting
+// @return Number of trees still waiting to be freed
+//
+
+int doreclaim_step(long int budget) ;
+
+
 
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
@@ -338,6 +446,267 @@ DATAOBJECT * dofindnode(DATAOBJECT *root, char *path) ;
 DATAOBJECT * dochild(DATAOBJECT *dh) ;
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of a node's next sibling
+// @param(in) dh DATAOBJECT handle
+// @return handle of next sibling, or NULL at the end of the chain
+//
+
+DATAOBJECT * donext(DATAOBJECT *dh) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the label of a node
+// @param(in) dh DATAOBJECT handle
+// @param(out) len Set to the length of the label (if not NULL)
+// @return null terminated label, or NULL if the node has none.
+//         The label remains valid while the node exists.
+//
+
+char * dolabel(DATAOBJECT *dh, int *len) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the type of a node
+// @param(in) dh DATAOBJECT handle
+// @return Record type, or do_unknown if dh is NULL
+//
+
+enum dataobject_type dotype(DATAOBJECT *dh) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Versions of doget* and doset* which operate on a node
+//        handle (e.g. from dofindnode, dogetnode, dochild or
+//        donext), so a record can be looked up once and then read
+//        or written many times without searching for its path
+//
+
+int donodegetuint(DATAOBJECT *dh, enum dataobject_type type, unsigned long int *n) ;
+int donodegetsint(DATAOBJECT *dh, enum dataobject_type type, long int *n) ;
+int donodegetreal(DATAOBJECT *dh, enum dataobject_type type, double *data) ;
+char * donodegetdata(DATAOBJECT *dh, enum dataobject_type type, int *datalen) ;
+
+int donodesetuint(DATAOBJECT *dh, enum dataobject_type type, unsigned long int data) ;
+int donodesetsint(DATAOBJECT *dh, enum dataobject_type type, signed long int data) ;
+int donodesetreal(DATAOBJECT *dh, enum dataobject_type type, double data) ;
+int donodesetdata(DATAOBJECT *dh, enum dataobject_type type, char *data, int datalen) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of a protobuf field (labelled "fXXXX")
+//        by number.  Fields and array entries are held by number,
+//        and a path component "#n" also matches either by number.
+//        If no entry has that number, "#n" matches an entry whose
+//        label is literally "#n" (e.g. from JSON).
+// @param(in) dh DATAOBJECT handle (start of the chain to search,
+//            e.g. the root, or dochild of a message)
+// @param(in) fieldnum Field number
+// @return handle of field, or NULL if not found
+//
+
+DATAOBJECT * dogetfield(DATAOBJECT *dh, int fieldnum) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of an entry in an array (or object)
+//        by position, in constant time once the array has been
+//        indexed
+// @param(in) dh DATAOBJECT handle
+// @param(in) path Path to the array
+// @param(in) i Position of entry (from 0)
+// @return handle of entry, or NULL if not found
+//
+
+DATAOBJECT * dogetindex(DATAOBJECT *dh, char *path, int i) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the number of entries in an array (or object)
+// @param(in) dh DATAOBJECT handle
+// @param(in) path Path to the array
+// @return Number of entries, or -1 if path is not found
+//
+
+int dosize(DATAOBJECT *dh, char *path) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Starts iterating over the entries of an object or
+//        array, in linear time and without allocating.  Values
+//        can be read and written through the node handles which
+//        are returned, but nodes must not be added, removed or
+//        renamed while iterating.
+// @param(out) it Caller's iterator
+// @param(in) dh DATAOBJECT handle
+// @param(in) path Path to the object, or NULL to iterate over
+//            dh's own entries (the top level entries if dh is the
+//            root of a tree)
+// @param(in) mode DO_ITER_SIBLINGS visits the entries in order.
+//            DO_ITER_DEPTHFIRST also visits every node beneath
+//            each entry, before the next entry, up to DO_ITERDEPTH
+//            levels down (it->truncated is set if any are skipped)
+// @return True on success, false if path is not found
+//
+// EXAMPLE
+//
+//  DOITER it ;
+//  doiter_begin(&it, dh, "/items", DO_ITER_SIBLINGS) ;
+//  while (doiter_next(&it)) {
+//    donodegetuint(dofindnode(dochild(doiter_node(&it)), "id"), do_uint64, &id) ;
+//  }
+//
+
+int doiter_begin(DOITER *it, DATAOBJECT *dh, char *path, int mode) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Steps an iterator to the next node
+// @param(in) it Iterator
+// @return Next node, or NULL when there are no more
+//
+
+DATAOBJECT * doiter_next(DOITER *it) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the iterator's current node, its label, and
+//        (when iterating depth first) its depth below the
+//        entries being iterated over
+//
+
+DATAOBJECT * doiter_node(DOITER *it) ;
+char * doiter_label(DOITER *it, int *len) ;
+int doiter_depth(DOITER *it) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Compiles a path for repeated use with the doget*_p and
+//        doset*_p functions, which then skip splitting the path
+//        and hashing its labels on every call.  A compiled path
+//        does not belong to any tree, and can be shared between
+//        trees and threads (the trees themselves can not).
+// @param(in) path Path to compile
+// @return Compiled path, or NULL on error.  Free with dofreepath
+//
+
+DOPATH * docompilepath(char *path) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Frees a path compiled with docompilepath
+// @param(in) p Compiled path (or NULL)
+//
+
+void dofreepath(DOPATH *p) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Versions of dofindnode, dogetnode, doget* and doset*
+//        which take a compiled path
+//
+
+DATAOBJECT * dofindnode_p(DATAOBJECT *dh, DOPATH *p) ;
+DATAOBJECT * dogetnode_p(DATAOBJECT *dh, DOPATH *p) ;
+
+int dogetuint_p(DATAOBJECT *dh, enum dataobject_type type, unsigned long int *n, DOPATH *p) ;
+int dogetsint_p(DATAOBJECT *dh, enum dataobject_type type, long int *n, DOPATH *p) ;
+int dogetreal_p(DATAOBJECT *dh, enum dataobject_type type, double *data, DOPATH *p) ;
+char * dogetdata_p(DATAOBJECT *dh, enum dataobject_type type, int *datalen, DOPATH *p) ;
+
+int dosetuint_p(DATAOBJECT *dh, enum dataobject_type type, unsigned long int data, DOPATH *p) ;
+int dosetsint_p(DATAOBJECT *dh, enum dataobject_type type, signed long int data, DOPATH *p) ;
+int dosetreal_p(DATAOBJECT *dh, enum dataobject_type type, double data, DOPATH *p) ;
+int dosetdata_p(DATAOBJECT *dh, enum dataobject_type type, char *data, int datalen, DOPATH *p) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Sets many items in one pass.  Entries are applied in
+//        order, and the path components which an entry shares
+//        with the previous entry are not searched again, so
+//        entries should be grouped by prefix, e.g.
+//        "/event/header/ts", "/event/header/src", "/event/body".
+//        Entries are not re-ordered, as that would change the
+//        order of new items in the tree.
+// @param(in) dh DATAOBJECT handle
+// @param(in) entries Items to set
+// @param(in) n Number of entries
+// @return Number of entries which were set (n on success)
+//
+
+int dosetmany(DATAOBJECT *dh, const dobatch_entry *entries, int n) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets many items in one pass, sharing path prefixes as
+//        dosetmany.  The value and ok fields of each entry are
+//        set.
+// @param(in) dh DATAOBJECT handle
+// @param(in/out) entries Items to get
+// @param(in) n Number of entries
+// @return Number of entries which were found
+//
+
+int dogetmany(DATAOBJECT *dh, dobatch_entry *entries, int n) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Finds every node matching a pattern, in one pass over
+//        the tree.  A pattern component of '*' matches every
+//        entry at that level, and '**' matches any number of
+//        levels, e.g. "/records/*/items/*/price" or "/**/price".
+//        A trailing '**' matches every node beneath.  Any other
+//        component matches every entry with that label (e.g.
+//        repeated protobuf fields, or duplicate JSON keys).
+// @param(in) dh DATAOBJECT handle
+// @param(in) pattern Pattern to match
+// @param(in) callback Called once with each matching node, even
+//            if the pattern reaches it in more than one way.
+//            Returning non-zero stops the query.  May be
+//            NULL, to just count matches.  The callback can read
+//            and write values, but must not add or remove nodes.
+// @param(in) ctx Passed to the callback
+// @return Number of matches (up to and including the one which
+//         stopped the query), or -1 on error
+//
+
+typedef int (*doquery_callback)(DATAOBJECT *node, void *ctx) ;
+
+int doquery(DATAOBJECT *dh, char *pattern, doquery_callback callback, void *ctx) ;
+
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
@@ -377,7 +746,12 @@ int dopastecopy(DATAOBJECT *root, char *path, DATAOBJECT *pasteptr, int merge) ;
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
-// @brief Output data as a JSON string
+// @brief Output data as a JSON string.  The string is held in
+//        an output buffer shared by the whole tree, and remains
+//        valid until the next doasjson / doasprotobuf call on
+//        any node in the tree, or until the root is cleared.
+//        The buffer is kept between calls, so it is only
+//        reallocated when the output outgrows it.
 // @param[in] dh Data object handle
 // @param[out] len Length of JSON data produced
 // @return JSON data string or NULL if error
@@ -386,6 +760,24 @@ int dopastecopy(DATAOBJECT *root, char *path, DATAOBJECT *pasteptr, int merge) ;
 char * doasjson(DATAOBJECT *dh, int *len) ;
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Output data as a JSON string into a caller supplied
+//        buffer, which can be re-used between calls.  Nothing
+//        is allocated.
+// @param[in] dh Data object handle
+// @param[out] buf Buffer to write to
+// @param[in] bufsize Size of buf
+// @param[out] len Length of JSON data (excluding the null
+//             terminator), set even if buf is too small
+// @return True on success, false if buf is too small (len+1
+//         bytes are required) or on error
+//
+
+int doasjson_into(DATAOBJECT *dh, char *buf, int bufsize, int *len) ;
+
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
@@ -398,6 +790,25 @@ char * doasjson(DATAOBJECT *dh, int *len) ;
 int dofromjson(DATAOBJECT *dh, char *json)  ;
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Import data from JSON without copying string values.
+//        The json buffer is modified (strings are unescaped and
+//        null terminated in place), and the string values in the
+//        tree point into it, so it must not be changed or freed
+//        until the nodes are cleared.  Labels are still copied.
+//        Nothing beyond json[len-1] is read or written, so the
+//        buffer need not be null terminated.
+// @param[in] dh Data object handle
+// @param[in] json JSON data, modified in place
+// @param[in] len Length of json
+// @return True on success, updates dojsonparsestrerror on failure
+//
+
+int dofromjson_insitu(DATAOBJECT *dh, char *json, int len)  ;
+
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
@@ -413,7 +824,7 @@ int doexpandfromjson(DATAOBJECT *root, char *path) ;
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
-// @brief Returns JSON Parse error strin
+// @brief Returns JSON Parse error string for the tree
 // @param(out) dh Data object handle
 // @return Parse error message 
 
@@ -431,7 +842,8 @@ char * dojsonparsestrerror(DATAOBJECT *dh) ;
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
-// @brief Output data as a Protobuf string
+// @brief Output data as a Protobuf string.  The data is held in
+//        the tree's shared output buffer (see doasjson).
 // @param[in] dh Data object handle
 // @param[out] len Length of Protobuf data produced
 // @return Protobuf data string or NULL if error
@@ -441,6 +853,35 @@ char * dojsonparsestrerror(DATAOBJECT *dh) ;
 char * doasprotobuf(DATAOBJECT *dh, int *len) ;
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Output data as a Protobuf string into a caller supplied
+//        buffer (see doasjson_into)
+// @param[in] dh Data object handle
+// @param[out] buf Buffer to write to
+// @param[in] bufsize Size of buf
+// @param[out] len Length of Protobuf data, set even if buf is
+//             too small
+// @return True on success, false if buf is too small or on error
+//
+
+int doasprotobuf_into(DATAOBJECT *dh, char *buf, int bufsize, int *len) ;
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the size of the Protobuf encoding of a tree,
+//        without producing it, e.g. to pre-allocate a buffer for
+//        doasprotobuf_into, or to frame the message
+// @param[in] dh Data object handle
+// @return Size in bytes, or -1 on error
+//
+
+int dosizeprotobuf(DATAOBJECT *dh) ;
+
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
@@ -453,6 +894,25 @@ char * doasprotobuf(DATAOBJECT *dh, int *len) ;
 int dofromprotobuf(DATAOBJECT *dh, char *protobuf, int buflen) ;
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Builds data object from protobuf source, without
+//        copying the length delimited (do_data) fields.  These
+//        reference the protobuf buffer directly, as do any
+//        nodes later expanded with doexpandfromprotobuf, so
+//        the buffer must not be changed or freed until the
+//        tree has been cleared.  Note that data returned by
+//        dogetdata for these fields is not null terminated.
+// @param[in] dh Data object handle
+// @param[in] protobuf Protobuf data
+// @param[out] buflen Length of Protobuf data
+// @return true on success
+//
+
+int dofromprotobuf_borrow(DATAOBJECT *dh, char *protobuf, int buflen) ;
+
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
@@ -0,0 +1,736 @@
+//
+// dataobjecttest.c
+//
+// Round trip and regression tests for the data object library.
+//
+// Each group of tests is run against heap, arena and pool backed
+// trees.  Failures are reported on stderr and the exit status is
+// the number of failed checks (capped at 255), so "make test" fails
+// if anything does.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "dataobject.h"
+
+static int checks = 0 ;
+static int failures = 0 ;
+static const char *modename = "" ;
+
+#define CHECK(cond) do { \
+  checks++ ; \
+  if (!(cond)) { \
+    failures++ ; \
+    fprintf(stderr, "%s:%d: [%s] %s\n", __FILE__, __LINE__, modename, #cond) ; \
+  } \
+} while (0)
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Creates a tree with the given allocation mode
+// @param(in) mode 0 heap, 1 arena, 2 pool
+// @return Tree
+//
+
+static DATAOBJECT *newtree(int mode)
+{
+  return (mode==0) ? donew() : (mode==1) ? donew_arena(0) : donew_pool(0) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Parses JSON into a fresh tree and writes it back out
+// @param(in) mode Allocation mode
+// @param(in) json JSON text
+// @param(out) out Buffer for the output
+// @param(in) outsize Size of out
+// @return True if the document parsed
+//
+
+static int rejson(int mode, const char *json, char *out, int outsize)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+  char *copy = strdup(json) ;
+  int ok = dofromjson(dh, copy) ;
+  int len ;
+  char *j = ok ? doasjson(dh, &len) : NULL ;
+  snprintf(out, outsize, "%s", j ? j : "") ;
+  dodelete(dh) ;
+  free(copy) ;
+  return ok ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the next value of a 64 bit xorshift generator
+// @param(in/out) s State
+// @return Random value
+//
+
+static uint64_t nextrandom(uint64_t *s)
+{
+  (*s) ^= (*s) << 13 ;
+  (*s) ^= (*s) >> 7 ;
+  (*s) ^= (*s) << 17 ;
+  return (*s) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// In place parsing of a buffer which is not null terminated
+//
+
+static void testinsitu(int mode)
+{
+  const char *json = "{\"a\":\"x\\ny\",\"b\":[1,2.5,true],\"c\":null}" ;
+  int n = strlen(json) ;
+  int len ;
+
+  // Every prefix is parsed from a buffer of exactly that size, so
+  // nothing past the end can be read without being noticed (e.g.
+  // under AddressSanitizer)
+
+  for (int l=0; l<=n; l++) {
+
+    char *buf = malloc(l ? l : 1) ;
+    memcpy(buf, json, l) ;
+    DATAOBJECT *dh = newtree(mode) ;
+    int ok = dofromjson_insitu(dh, buf, l) ;
+    CHECK(ok==(l==0 || l==n)) ;
+
+    if (l==n) {
+      int dlen ;
+      char *a = dogetdata(dh, do_string, &dlen, "/a") ;
+      CHECK(a && dlen==3 && memcmp(a, "x\ny", 3)==0 && a>=buf && a<buf+n) ;
+      char *j = doasjson(dh, &len) ;
+      CHECK(j && strcmp(j, "{\"a\":\"x\\ny\",\"b\":[1,2.5,true],\"c\":null}")==0) ;
+    }
+
+    dodelete(dh) ;
+    free(buf) ;
+
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Protobuf wire format
+//
+
+static void testprotobuf(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+
+  CHECK(dosetuint(dh, do_uint32, 7, "/f1")) ;
+  CHECK(dosetsint(dh, do_sint64, -123456789, "/f2")) ;
+  CHECK(dosetuint(dh, do_fixed32, 0xdeadbeef, "/f3")) ;
+  CHECK(dosetuint(dh, do_fixed64, 0x0123456789abcdefUL, "/f4")) ;
+  CHECK(dosetreal(dh, do_double, 3.25, "/f5")) ;
+  CHECK(dosetreal(dh, do_float, 1.5, "/f6")) ;
+  CHECK(dosetdata(dh, do_string, "hello", 5, "/f7")) ;
+  CHECK(dosetuint(dh, do_uint64, 300, "/f8/f1")) ;
+  CHECK(dosetuint(dh, do_bool, 1, "/f9")) ;
+
+  // The size pass agrees with the output, and with output into a
+  // caller's buffer
+
+  int len ;
+  char *pb = doasprotobuf(dh, &len) ;
+  CHECK(pb!=NULL && len==dosizeprotobuf(dh)) ;
+  if (!pb) { dodelete(dh) ; return ; }
+  char *copy = malloc(len) ;
+  memcpy(copy, pb, len) ;
+
+  char small[8], big[128] ;
+  int intolen = 0 ;
+  CHECK(!doasprotobuf_into(dh, small, sizeof(small), &intolen) && intolen==len) ;
+  CHECK(doasprotobuf_into(dh, big, sizeof(big), &intolen) && intolen==len && memcmp(big, copy, len)==0) ;
+
+  // Decode, set the types (which the wire format doesn't carry),
+  // and read back
+
+  DATAOBJECT *rh = newtree(mode) ;
+  CHECK(dofromprotobuf(rh, copy, len)) ;
+  CHECK(dosettype(rh, do_uint32, "/f1")) ;
+  CHECK(dosettype(rh, do_sint64, "/f2")) ;
+  CHECK(dosettype(rh, do_fixed32, "/f3")) ;
+  CHECK(dosettype(rh, do_fixed64, "/f4")) ;
+  CHECK(dosettype(rh, do_double, "/f5")) ;
+  CHECK(dosettype(rh, do_float, "/f6")) ;
+  CHECK(dosettype(rh, do_string, "/f7")) ;
+  CHECK(dosettype(rh, do_bool, "/f9")) ;
+
+  unsigned long int u ;
+  long int s ;
+  double d ;
+  int dlen ;
+
+  CHECK(dogetuint(rh, do_uint32, &u, "/f1") && u==7) ;
+  CHECK(dogetsint(rh, do_sint64, &s, "/f2") && s==-123456789) ;
+  CHECK(dogetuint(rh, do_fixed32, &u, "/f3") && u==0xdeadbeef) ;
+  CHECK(dogetuint(rh, do_fixed64, &u, "/f4") && u==0x0123456789abcdefUL) ;
+  CHECK(dogetreal(rh, do_double, &d, "/f5") && d==3.25) ;
+  CHECK(dogetreal(rh, do_float, &d, "/f6") && d==1.5) ;
+  char *str = dogetdata(rh, do_string, &dlen, "/f7") ;
+  CHECK(str && dlen==5 && memcmp(str, "hello", 5)==0) ;
+  CHECK(dogetuint(rh, do_bool, &u, "/f9") && u==1) ;
+
+  // Re-encoding gives the same bytes, before and after expanding
+  // the embedded message
+
+  pb = doasprotobuf(rh, &len) ;
+  CHECK(pb && memcmp(pb, copy, len)==0) ;
+
+  CHECK(doexpandfromprotobuf(rh, "/f8")) ;
+  CHECK(dogetuint(rh, do_uint64, &u, "/f8/f1") && u==300) ;
+  pb = doasprotobuf(rh, &len) ;
+  CHECK(pb && memcmp(pb, copy, len)==0) ;
+
+  dodelete(rh) ;
+  dodelete(dh) ;
+  free(copy) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Long chains (which are indexed) and renaming
+//
+
+static void testchains(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+  char path[64], name[32] ;
+  const int n = 2000 ;
+  long int v ;
+  int bad = 0 ;
+
+  for (int i=0; i<n; i++) {
+    sprintf(path, "/o/k%d", i) ;
+    if (!dosetsint(dh, do_sint64, i, path)) bad++ ;
+  }
+  for (int i=0; i<n; i++) {
+    sprintf(path, "/o/k%d", i) ;
+    if (!dogetsint(dh, do_sint64, &v, path) || v!=i) bad++ ;
+  }
+  CHECK(bad==0) ;
+  CHECK(dosize(dh, "/o")==n) ;
+
+  // Rename every other entry, and check old and new names
+
+  bad = 0 ;
+  for (int i=0; i<n; i+=2) {
+    sprintf(path, "/o/k%d", i) ;
+    sprintf(name, "r%d", i) ;
+    if (!dorenamenode(dh, path, name)) bad++ ;
+  }
+  for (int i=0; i<n; i++) {
+    sprintf(path, (i&1) ? "/o/k%d" : "/o/r%d", i) ;
+    if (!dogetsint(dh, do_sint64, &v, path) || v!=i) bad++ ;
+    sprintf(path, (i&1) ? "/o/r%d" : "/o/k%d", i) ;
+    if (dofindnode(dh, path)) bad++ ;
+  }
+  CHECK(bad==0) ;
+
+  // Renaming onto an existing label makes a duplicate (the first
+  // is still found); renaming it back restores both lookups
+
+  CHECK(dorenamenode(dh, "/o/k1", "k3")) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/o/k3") && v==1) ;
+  CHECK(dorenamenode(dh, "/o/k3", "k1")) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/o/k1") && v==1) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/o/k3") && v==3) ;
+
+  // Clearing the chain's owner and refilling it
+
+  CHECK(doclear(dofindnode(dh, "/o"))) ;
+  CHECK(dosetsint(dh, do_sint64, 5, "/o/k5")) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/o/k5") && v==5 && !dofindnode(dh, "/o/k6")) ;
+
+  dodelete(dh) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Appending through handles other than the root
+//
+
+static void testappend(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+  char path[64] ;
+  const int n = 2000 ;
+  long int v ;
+  int bad = 0 ;
+
+  // Through the head of the chain, as returned by dochild
+
+  CHECK(dosetsint(dh, do_sint64, 0, "/o/k0")) ;
+  DATAOBJECT *head = dochild(dofindnode(dh, "/o")) ;
+  CHECK(head!=NULL) ;
+  for (int i=1; i<n; i++) {
+    sprintf(path, "k%d", i) ;
+    if (!dosetsint(head, do_sint64, i, path)) bad++ ;
+  }
+  CHECK(bad==0) ;
+  CHECK(dosize(dh, "/o")==n) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/o/k1999") && v==1999) ;
+
+  // Through a handle in the middle of the chain
+
+  DATAOBJECT *mid = dofindnode(dh, "/o/k501") ;
+  CHECK(mid!=NULL) ;
+  CHECK(dosetsint(mid, do_sint64, -1, "new")) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/o/new") && v==-1) ;
+  CHECK(dosize(dh, "/o")==n+1) ;
+  CHECK(dogetsint(mid, do_sint64, &v, "new") && v==-1) ;
+
+  // An existing label is found, not appended again
+
+  CHECK(dosetsint(mid, do_sint64, -2, "k1999")) ;
+  CHECK(dosize(dh, "/o")==n+1) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/o/k1999") && v==-2) ;
+
+  dodelete(dh) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// dosetmany / dogetmany
+//
+
+static void testmany(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+
+  dobatch_entry set[5] ;
+  memset(set, 0, sizeof(set)) ;
+  set[0].path = "/event/header/ts" ; set[0].type = do_uint64 ; set[0].u = 1700000000 ;
+  set[1].path = "/event/header/src" ; set[1].type = do_string ; set[1].data = "sensor" ; set[1].datalen = 6 ;
+  set[2].path = "/event/body/temp" ; set[2].type = do_double ; set[2].real = -3.5 ;
+  set[3].path = "/event/body/delta" ; set[3].type = do_sint64 ; set[3].s = -42 ;
+  set[4].path = "/event/id" ; set[4].type = do_uint32 ; set[4].u = 7 ;
+  CHECK(dosetmany(dh, set, 5)==5) ;
+
+  int len ;
+  char *j = doasjson(dh, &len) ;
+  CHECK(j && strcmp(j, "{\"event\":{\"header\":{\"ts\":1700000000,\"src\":\"sensor\"},"
+                       "\"body\":{\"temp\":-3.5,\"delta\":-42},\"id\":7}}")==0) ;
+
+  dobatch_entry get[6] ;
+  memset(get, 0, sizeof(get)) ;
+  for (int i=0; i<5; i++) { get[i].path = set[i].path ; get[i].type = set[i].type ; }
+  get[5].path = "/event/missing" ; get[5].type = do_uint32 ;
+  CHECK(dogetmany(dh, get, 6)==5) ;
+  CHECK(get[0].ok && get[0].u==1700000000) ;
+  CHECK(get[1].ok && get[1].datalen==6 && memcmp(get[1].data, "sensor", 6)==0) ;
+  CHECK(get[2].ok && get[2].real==-3.5) ;
+  CHECK(get[3].ok && get[3].s==-42) ;
+  CHECK(get[4].ok && get[4].u==7) ;
+  CHECK(!get[5].ok) ;
+
+  // Setting again updates in place rather than adding entries
+
+  set[3].s = 42 ;
+  CHECK(dosetmany(dh, set, 5)==5) ;
+  CHECK(dosize(dh, "/event/body")==2) ;
+  CHECK(dogetmany(dh, get, 4)==4 && get[3].s==42) ;
+
+  dodelete(dh) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Queries
+//
+
+static int sumvalues(DATAOBJECT *node, void *ctx)
+{
+  long int v = 0 ;
+  donodegetsint(node, do_sint64, &v) ;
+  (*(long int *)ctx) += v ;
+  return 0 ;
+}
+
+static int stopatfirst(DATAOBJECT *node, void *ctx)
+{
+  (void)node ;
+  (void)ctx ;
+  return 1 ;
+}
+
+static void testquery(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+  char *json = strdup("{\"x\":1,\"a\":{\"x\":2,\"a\":{\"b\":3,\"x\":4}},\"x\":5,\"b\":6,\"y\":{\"x\":7,\"x\":8}}") ;
+  CHECK(dofromjson(dh, json)) ;
+
+  long int sum ;
+
+  // Literal components match every sibling with the label
+
+  sum = 0 ;
+  CHECK(doquery(dh, "/x", sumvalues, &sum)==2 && sum==6) ;
+  sum = 0 ;
+  CHECK(doquery(dh, "/y/x", sumvalues, &sum)==2 && sum==15) ;
+
+  // Wildcards, with each node reported once however many ways
+  // the pattern reaches it
+
+  sum = 0 ;
+  CHECK(doquery(dh, "/**/x", sumvalues, &sum)==6 && sum==27) ;
+  CHECK(doquery(dh, "/**/**/x", NULL, NULL)==6) ;
+  CHECK(doquery(dh, "/**/a/**/b", NULL, NULL)==1) ;
+  CHECK(doquery(dh, "/**", NULL, NULL)==11) ;
+  CHECK(doquery(dh, "/*/x", NULL, NULL)==3) ;
+  CHECK(doquery(dh, "/nothere", NULL, NULL)==0) ;
+
+  // The callback can stop the query
+
+  CHECK(doquery(dh, "/**/x", stopatfirst, NULL)==1) ;
+
+  dodelete(dh) ;
+  free(json) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Numbered protobuf fields and "#n" paths
+//
+
+static void testkeys(int mode)
+{
+  long int v ;
+  unsigned long int u ;
+  int len ;
+
+  // Fields are found by "fN" and "#N"
+
+  DATAOBJECT *ph = newtree(mode) ;
+  CHECK(dosetuint(ph, do_uint64, 1, "/f1")) ;
+  CHECK(dosetuint(ph, do_uint64, 2, "/f2")) ;
+  CHECK(dogetuint(ph, do_uint64, &u, "/#2") && u==2) ;
+
+  // Repeated fields are all kept, and all reached by a query
+
+  char twice[64] ;
+  int n = 0 ;
+  char *pb = doasprotobuf(ph, &len) ;
+  if (pb && len*2<=(int)sizeof(twice)) {
+    memcpy(twice, pb, len) ;
+    memcpy(twice+len, pb, len) ;
+    n = len*2 ;
+  }
+  DATAOBJECT *qh = newtree(mode) ;
+  CHECK(n && dofromprotobuf(qh, twice, n)) ;
+  CHECK(doquery(qh, "/f1", NULL, NULL)==2) ;
+  CHECK(doquery(qh, "/#2", NULL, NULL)==2) ;
+  CHECK(dogetuint(qh, do_uint64, &u, "/#2") && u==2) ;
+
+  // A literal "#n" label (e.g. from JSON) is still reachable
+
+  DATAOBJECT *dh = newtree(mode) ;
+  CHECK(dofromjson(dh, "{\"#5\":1,\"b\":[10,11,12]}")) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/#5") && v==1) ;
+  CHECK(doquery(dh, "/#5", NULL, NULL)==1) ;
+
+  // Array entries are keyed by position
+
+  CHECK(dogetsint(dh, do_sint64, &v, "/b/2") && v==12) ;
+  CHECK(dogetsint(dh, do_sint64, &v, "/b/#1") && v==11) ;
+  CHECK(!dofindnode(dh, "/b/3")) ;
+
+  dodelete(dh) ;
+  dodelete(qh) ;
+  dodelete(ph) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Deferred deletion
+//
+
+static void testreclaim(int mode)
+{
+  char path[32] ;
+
+  for (int t=0; t<8; t++) {
+    DATAOBJECT *dh = newtree(mode) ;
+    for (int i=0; i<500; i++) {
+      sprintf(path, "/a%d/b/c", i) ;
+      dosetsint(dh, do_sint64, i, path) ;
+    }
+    CHECK(dodelete_async(dh)) ;
+  }
+
+  int steps = 0 ;
+  while (doreclaim_step(100)>0 && steps<100000) steps++ ;
+  CHECK(steps<100000) ;
+  CHECK(doreclaim_step(0)==0) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Integers, and number parsing
+//
+
+static void testintegers(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+  unsigned long int u ;
+  long int s ;
+
+  // Signed (zigzag) values read as unsigned give their magnitude
+
+  CHECK(dosetsint(dh, do_sint64, -5, "/a")) ;
+  CHECK(dogetuint(dh, do_sint64, &u, "/a") && u==5) ;
+  CHECK(dogetsint(dh, do_sint64, &s, "/a") && s==-5) ;
+
+  CHECK(dosetsint(dh, do_sint32, -2147483647L-1, "/b")) ;
+  CHECK(dogetuint(dh, do_sint32, &u, "/b") && u==2147483648UL) ;
+  CHECK(dogetsint(dh, do_sint32, &s, "/b") && s==-2147483647L-1) ;
+
+  CHECK(dosetsint(dh, do_sint64, INT64_MIN, "/c")) ;
+  CHECK(dogetuint(dh, do_sint64, &u, "/c") && u==(unsigned long int)INT64_MAX+1) ;
+  CHECK(dogetsint(dh, do_sint64, &s, "/c") && s==INT64_MIN) ;
+
+  CHECK(dosetsint(dh, do_sint64, 7, "/d")) ;
+  CHECK(dogetuint(dh, do_sint64, &u, "/d") && u==7) ;
+
+  CHECK(dosetuint(dh, do_uint64, UINT64_MAX, "/e")) ;
+  CHECK(dogetuint(dh, do_uint64, &u, "/e") && u==UINT64_MAX) ;
+
+  dodelete(dh) ;
+}
+
+static void testparsing(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+  unsigned long int u ;
+  long int s ;
+  double d ;
+  char out[256] ;
+
+  char *json = strdup("{\"a\":9223372036854775807,\"b\":-9223372036854775808,"
+                      "\"c\":18446744073709551615,\"d\":18446744073709551616,"
+                      "\"e\":1e5,\"f\":-2.5E-3,\"g\":0.1000000000000000055511151231257827021181583404541015625,"
+                      "\"h\":9007199254740993.0,\"i\":1e400,\"j\":-0}") ;
+  CHECK(dofromjson(dh, json)) ;
+
+  CHECK(dotype(dofindnode(dh, "/a"))==do_sint64 && dogetsint(dh, do_sint64, &s, "/a") && s==INT64_MAX) ;
+  CHECK(dotype(dofindnode(dh, "/b"))==do_sint64 && dogetsint(dh, do_sint64, &s, "/b") && s==INT64_MIN) ;
+  CHECK(dotype(dofindnode(dh, "/c"))==do_uint64 && dogetuint(dh, do_uint64, &u, "/c") && u==UINT64_MAX) ;
+  CHECK(dotype(dofindnode(dh, "/d"))==do_double && dogetreal(dh, do_double, &d, "/d") && d==18446744073709551616.0) ;
+  CHECK(dotype(dofindnode(dh, "/e"))==do_double && dogetreal(dh, do_double, &d, "/e") && d==1e5) ;
+  CHECK(dogetreal(dh, do_double, &d, "/f") && d==-2.5e-3) ;
+  CHECK(dogetreal(dh, do_double, &d, "/g") && d==0.1) ;
+  CHECK(dogetreal(dh, do_double, &d, "/h") && d==9007199254740992.0) ;
+  CHECK(dogetreal(dh, do_double, &d, "/i") && isinf(d)) ;
+  CHECK(dogetsint(dh, do_sint64, &s, "/j") && s==0) ;
+
+  // Malformed numbers are rejected
+
+  static const char *bad[] = { "{\"a\":1.2.3}", "{\"a\":--1}", "{\"a\":1e}", "{\"a\":.}", "{\"a\":1x}" } ;
+  for (unsigned int i=0; i<sizeof(bad)/sizeof(bad[0]); i++) {
+    CHECK(!rejson(mode, bad[i], out, sizeof(out))) ;
+  }
+
+  dodelete(dh) ;
+  free(json) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// JSON string unescaping
+//
+
+static void testunescape(int mode)
+{
+  DATAOBJECT *dh = newtree(mode) ;
+  int dlen = 0 ;
+  char *r ;
+
+  // Every escape, including a surrogate pair
+
+  CHECK(dofromjson(dh, "{\"s\":\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\ud83d\\ude00\\u0041\"}")) ;
+  r = dogetdata(dh, do_string, &dlen, "/s") ;
+  CHECK(r && dlen==15 && memcmp(r, "\"\\/\b\f\n\r\t\xc3\xa9\xf0\x9f\x98\x80" "A", 15)==0) ;
+
+  // Long runs without escapes either side of one
+
+  char json[300], expect[260] ;
+  memset(expect, 'a', 200) ;
+  expect[100] = '\n' ;
+  sprintf(json, "{\"s\":\"%.100s\\n%.99s\"}", expect, expect+101) ;
+  CHECK(dofromjson(dh, json)) ;
+  r = dogetdata(dh, do_string, &dlen, "/s") ;
+  CHECK(r && dlen==200 && memcmp(r, expect, 200)==0) ;
+
+  dodelete(dh) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// JSON string escaping
+//
+
+static void testescape(int mode)
+{
+  char out[256] ;
+
+  // Every ASCII character, and some UTF-8, round trip through
+  // doasjson and dofromjson
+
+  char s[160] ;
+  int n = 0 ;
+  for (int c=1; c<128; c++) s[n++] = (char)c ;
+  memcpy(s+n, "\xc3\xa9\xf0\x9f\x98\x80", 6) ;
+  n += 6 ;
+
+  DATAOBJECT *dh = newtree(mode) ;
+  DATAOBJECT *rh = newtree(mode) ;
+  CHECK(dosetdata(dh, do_string, s, n, "/s")) ;
+  int len ;
+  char *j = strdup(doasjson(dh, &len)) ;
+  CHECK(dofromjson(rh, j)) ;
+  int dlen = 0 ;
+  char *r = dogetdata(rh, do_string, &dlen, "/s") ;
+  CHECK(r && dlen==n && memcmp(r, s, n)==0) ;
+  free(j) ;
+
+  // Control characters are written as escapes
+
+  CHECK(rejson(mode, "{\"s\":\"a\\u0001b\\tc\"}", out, sizeof(out))) ;
+  CHECK(strcmp(out, "{\"s\":\"a\\u0001b\\tc\"}")==0) ;
+
+  // Labels are kept as written, so come back out unchanged
+
+  CHECK(rejson(mode, "{\"a\\\"b\":1}", out, sizeof(out))) ;
+  CHECK(strcmp(out, "{\"a\\\"b\":1}")==0) ;
+
+  dodelete(rh) ;
+  dodelete(dh) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// Number formatting
+//
+
+static void testformat(int mode)
+{
+  static const char *cases[][2] = {
+    { "{\"a\":0}", "{\"a\":0}" },
+    { "{\"a\":-1}", "{\"a\":-1}" },
+    { "{\"a\":9223372036854775807}", "{\"a\":9223372036854775807}" },
+    { "{\"a\":-9223372036854775808}", "{\"a\":-9223372036854775808}" },
+    { "{\"a\":18446744073709551615}", "{\"a\":18446744073709551615}" },
+    { "{\"a\":1.5}", "{\"a\":1.5}" },
+    { "{\"a\":0.1}", "{\"a\":0.1}" },
+    { "{\"a\":1e3}", "{\"a\":1000.0}" },
+    { "{\"a\":-2.5E-3}", "{\"a\":-0.0025}" },
+    { "{\"a\":5e-324}", "{\"a\":5e-324}" },
+    { "{\"a\":1.7976931348623157e308}", "{\"a\":1.7976931348623157e308}" },
+    { "{\"a\":9007199254740993.0}", "{\"a\":9007199254740992.0}" },
+  } ;
+
+  char out[256] ;
+  for (unsigned int i=0; i<sizeof(cases)/sizeof(cases[0]); i++) {
+    int ok = rejson(mode, cases[i][0], out, sizeof(out)) ;
+    CHECK(ok && strcmp(out, cases[i][1])==0) ;
+    if (!ok || strcmp(out, cases[i][1])) fprintf(stderr, "  %s -> %s\n", cases[i][0], out) ;
+  }
+
+  // Values which aren't numbers in JSON are written as null
+
+  DATAOBJECT *dh = newtree(mode) ;
+  int len ;
+  CHECK(dosetreal(dh, do_double, NAN, "/n")) ;
+  CHECK(dosetreal(dh, do_double, INFINITY, "/i")) ;
+  char *j = doasjson(dh, &len) ;
+  CHECK(j && strcmp(j, "{\"n\":null,\"i\":null}")==0) ;
+
+  // Random doubles and floats survive JSON output and input
+  // exactly
+
+  DATAOBJECT *rh = newtree(mode) ;
+  uint64_t seed = 0x9e3779b97f4a7c15ULL ;
+  int mismatches = 0 ;
+
+  for (int i=0; i<20000; i++) {
+
+    uint64_t bits = nextrandom(&seed) ;
+    double x ;
+    memcpy(&x, &bits, sizeof(x)) ;
+    if (!isfinite(x)) continue ;
+
+    uint32_t fbits = (uint32_t)(bits >> 16) ;
+    float f ;
+    memcpy(&f, &fbits, sizeof(f)) ;
+    if (!isfinite(f)) f = 0 ;
+
+    doclear(dh) ;
+    dosetreal(dh, do_double, x, "/d") ;
+    dosetreal(dh, do_float, f, "/f") ;
+    j = strdup(doasjson(dh, &len)) ;
+
+    double d = 0, g = 0 ;
+    doclear(rh) ;
+    if (!dofromjson(rh, j) ||
+        !dogetreal(rh, do_double, &d, "/d") || memcmp(&d, &x, sizeof(d)) ||
+        !dogetreal(rh, do_double, &g, "/f") || (float)g!=f) {
+      if (!mismatches++) fprintf(stderr, "  %s\n", j) ;
+    }
+    free(j) ;
+
+  }
+
+  CHECK(mismatches==0) ;
+
+  dodelete(rh) ;
+  dodelete(dh) ;
+}
+
+
+int main(void)
+{
+  static const char *modes[] = { "heap", "arena", "pool" } ;
+
+  for (int mode=0; mode<3; mode++) {
+    modename = modes[mode] ;
+    testinsitu(mode) ;
+    testprotobuf(mode) ;
+    testchains(mode) ;
+    testappend(mode) ;
+    testmany(mode) ;
+    testquery(mode) ;
+    testkeys(mode) ;
+    testreclaim(mode) ;
+    testintegers(mode) ;
+    testparsing(mode) ;
+    testunescape(mode) ;
+    testescape(mode) ;
+    testformat(mode) ;
+  }
+
+  printf("%d checks, %d failed\n", checks, failures) ;
+  return (failures>255) ? 255 : failures ;
+}
@@ -48,6 +48,9 @@
 
 // Local Functions
 
+static void _do_clearchain(IDOCONTEXT *ctx, IDATAOBJECT *dh, int cleartop) ;
+static void _do_resetnode(IDOCONTEXT *ctx, IDATAOBJECT *dn) ;
+
 
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
@@ -58,14 +61,45 @@
 
 IDATAOBJECT *donew()
 {
-  IDATAOBJECT *dh ;
-  dh=malloc(sizeof(IDATAOBJECT)) ;
-  if (!dh) return NULL ;
+  IDOCONTEXT *ctx = _do_newcontext(DO_MODE_HEAP, 0) ;
+  if (!ctx) return NULL ;
+
+  return &(ctx->root) ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Creates a data object whose tree is allocated from
+//        chunks owned by the root
+// @param(in) sizehint Expected size of the tree in bytes (0 for default)
+// @return pointer to IDATAOBJECT, or NULL on error (errno set)
+//
 
-  memset(dh, '\0', sizeof(IDATAOBJECT)) ;
-  dh->type = -1 ;
+IDATAOBJECT *donew_arena(unsigned long int sizehint)
+{
+  IDOCONTEXT *ctx = _do_newcontext(DO_MODE_ARENA, sizehint) ;
+  if (!ctx) return NULL ;
+
+  return &(ctx->root) ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Creates a data object which recycles its memory
+// @param(in) sizehint Expected size of the tree in bytes (0 for default)
+// @return pointer to IDATAOBJECT, or NULL on error (errno set)
+//
+
+IDATAOBJECT *donew_pool(unsigned long int sizehint)
+{
+  IDOCONTEXT *ctx = _do_newcontext(DO_MODE_POOL, sizehint) ;
+  if (!ctx) return NULL ;
 
-  return dh ;
+  return &(ctx->root) ;
 }
 
 
@@ -81,58 +115,163 @@ IDATAOBJECT *donew()
 int doclear(IDATAOBJECT *dh)
 {
   // Clear everything but don't free the top handle
-  _do_clear(dh, 0, 1) ;
+  return _do_clear(dh, 0) ;
 }
 
-int _do_clear(IDATAOBJECT *dh, int cleartop, int cleartopjsonerror)
+int _do_clear(IDATAOBJECT *dh, int cleartop)
 {
   if (!dh) {
     fprintf(stderr, "doclear: called with NULL handle\n") ;
     return 0 ;
   }
 
-  // Delete chain
+  IDOCONTEXT *ctx = dh->ctx ;
 
-  IDATAOBJECT *dn = dh ;
+  // Clearing the root also clears the tree's output buffer
+  // and parse error
 
-  while (dn) {
+  if (dh==&ctx->root) {
+    _do_cleartmp(ctx, &(ctx->tmpbuf)) ;
+    ctx->jsonparsestatus[0]='\0' ;
+  }
 
-    IDATAOBJECT *next = dn->next ;
+  // Clearing from part way along a chain invalidates the chain's
+  // index
 
-    // Recurse into child
+  if (!_do_ishead(dh) && (dh->next || _do_haslabel(dh)) && ctx->nchains) {
+    ctx->epoch++ ;
+  }
 
-    if (dn->child) { _do_clear(dn->child, 1, 1) ; }
+  if ( ctx->mode==DO_MODE_ARENA ||
+       ( ctx->mode==DO_MODE_POOL && dh==&ctx->root ) ) {
 
-    // Reset associated data
+    // Nothing is freed individually in an arena.  Clearing the
+    // root releases all of the chunks (or recycles them for a pool),
+    // otherwise the sub-tree is detached, and reclaimed when the root
+    // is cleared.
 
-    dn->child = NULL ;
-    dn->next = NULL ;
+    if (dh==&ctx->root) {
+      _do_resetcontext(ctx) ;
+      dh->chain = NULL ;
+    } else if (cleartop) {
+      return 1 ;
+    } else {
+      _do_chainfree(dh) ;
+    }
+
+    dh->child = NULL ;
+    dh->next = NULL ;
+    dh->label = NULL ;
+    dh->d1 = 0 ;
+    dh->d2 = NULL ;
+    dh->type = -1 ;
+    dh->isarray = 0 ;
+    dh->flags &= DO_F_HEAD ;
 
-    dn->d1=0 ;
-    dn->type=-1 ;
-    dn->isarray=0 ;
+    return 1 ;
+  }
 
-    if (dn->tmpbuf) free(dn->tmpbuf) ; dn->tmpbuf=NULL ;
-    if (dn->label) free(dn->label) ; dn->label=NULL ;
-    if (dn->d2) free(dn->d2) ; dn->d2=NULL ;
+  _do_clearchain(ctx, dh, cleartop) ;
 
-    if ((cleartop || dn!=dh || cleartopjsonerror) && dn->jsonparsestatus) {
-      free(dn->jsonparsestatus) ;
-      dn->jsonparsestatus=NULL ;
-    }
-    
-    if (dn!=dh || cleartop) {
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Frees a chain, and everything below it
+// @param(in) ctx Tree context
+// @param(in) dh Start of chain
+// @param(in) cleartop If true, frees dh itself
+//
+
+static void _do_clearchain(IDOCONTEXT *ctx, IDATAOBJECT *dh, int cleartop)
+{
+  if (cleartop || dh==&ctx->root) {
+    _do_clearnodes(ctx, dh, NULL) ;
+    return ;
+  }
+
+  // dh itself is kept, but emptied
+
+  IDATAOBJECT *child = dh->child ;
+  IDATAOBJECT *next = dh->next ;
 
-      // Remove the structure itself
+  _do_chainfree(dh) ;
+  dh->child = NULL ;
+  dh->next = NULL ;
+  _do_resetnode(ctx, dh) ;
 
-      free(dn) ;
+  _do_clearnodes(ctx, child, NULL) ;
+  _do_clearnodes(ctx, next, NULL) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Resets a node's label and data
+// @param(in) ctx Tree context
+// @param(in) dn Node to reset
+//
 
+static void _do_resetnode(IDOCONTEXT *ctx, IDATAOBJECT *dn)
+{
+  _do_labelrelease(ctx, dn->label) ; dn->label=NULL ;
+  dn->flags &= ~(DO_F_KEY|DO_F_FIELD) ;
+  _do_cleardata(dn) ;
+
+  dn->d1=0 ;
+  dn->type=-1 ;
+  dn->isarray=0 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Frees a chain, and everything below it, without
+//        recursing.  Whenever the current node has a child, the
+//        child is rotated up to take its place (the child's
+//        siblings become the node's children, and the node
+//        follows the child), so the tree is flattened into a
+//        single chain as it is freed, in linear time.  The root
+//        of the tree is reset rather than freed.
+// @param(in) ctx Tree context
+// @param(in) dn Start of chain (may be NULL)
+// @param(in) budget If not NULL, the maximum number of nodes to
+//            free, which is reduced by the number freed
+// @return Node to resume from, or NULL when everything is freed
+//
+
+IDATAOBJECT *_do_clearnodes(IDOCONTEXT *ctx, IDATAOBJECT *dn, long int *budget)
+{
+  while (dn) {
+
+    IDATAOBJECT *child = dn->child ;
+
+    if (child) {
+      dn->child = child->next ;
+      child->next = dn ;
+      dn = child ;
+      continue ;
+    }
+
+    if (budget && (*budget)--<=0) {
+      *budget = 0 ;
+      return dn ;
     }
 
+    IDATAOBJECT *next = dn->next ;
+
+    _do_chainfree(dn) ;
+    dn->next = NULL ;
+    _do_resetnode(ctx, dn) ;
+
+    if (dn!=&ctx->root) _do_freenode(dn) ;
+
     dn=next ;
   }
 
-  return 1 ;
+  return NULL ;
 }
 
 
@@ -148,8 +287,14 @@ int dodelete(IDATAOBJECT *dh)
     return 0 ;
   }
 
+  IDOCONTEXT *ctx = dh->ctx ;
+  int isroot = (dh==&ctx->root) ;
+
   // Clear structure entirely
-  _do_clear(dh, 1, 1) ;
+  _do_clear(dh, 1) ;
+
+  // And release the context if this is the root
+  if (isroot) _do_freecontext(ctx) ;
 
   return 1 ;
 }
@@ -185,131 +330,748 @@ IDATAOBJECT *dosearchrecord(IDATAOBJECT *root, char *path)
   else return result ;
 }
 
-///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of a node at the given path, and create if not exiting
+// @param(in) dh IDATAOBJECT handler
+// @param(in) path Path in dh to get
+// @return handle of the node
+
+IDATAOBJECT * dogetnode(IDATAOBJECT *dh, char *path)
+{
+  return _do_search(dh, path, 1) ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of a node at the given path
+// @param(in) dh IDATAOBJECT handler
+// @param(in) path Path in dh to get
+// @return handle of the node
+
+IDATAOBJECT * dofindnode(IDATAOBJECT *dh, char *path)
+{
+  return _do_search(dh, path, 0) ;
+}
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of a node's child
+// @param(in) dh DATAOBJECT handler
+// @return handle of new node created
+
+IDATAOBJECT * dochild(DATAOBJECT *dh) 
+{
+  if (!dh) return NULL ;
+  else return dh->child ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of a node's next sibling
+// @param(in) dh DATAOBJECT handle
+// @return handle of next sibling, or NULL at the end of the chain
+//
+
+IDATAOBJECT * donext(IDATAOBJECT *dh)
+{
+  if (!dh) return NULL ;
+  else return dh->next ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the label of a node
+// @param(in) dh DATAOBJECT handle
+// @param(out) len Set to the length of the label (if not NULL)
+// @return null terminated label, or NULL if the node has none
+//
+
+char * dolabel(IDATAOBJECT *dh, int *len)
+{
+  char *label = dh ? _do_nodelabel(dh) : NULL ;
+  if (len) (*len) = _do_labellen(label) ;
+  return label ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the type of a node
+// @param(in) dh DATAOBJECT handle
+// @return Record type, or do_unknown if dh is NULL
+//
+
+enum dataobject_type dotype(IDATAOBJECT *dh)
+{
+  if (!dh) return do_unknown ;
+  else return dh->type ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Versions of doget* and doset* which operate on a node
+//        handle (e.g. from dofindnode, dochild or donext), rather
+//        than searching for a path
+//
+
+int donodegetuint(IDATAOBJECT *dh, enum dataobject_type type, unsigned long int *n)
+{
+  return _do_getuint(dh, type, n) ;
+}
+
+int donodegetsint(IDATAOBJECT *dh, enum dataobject_type type, long int *n)
+{
+  return _do_getsint(dh, type, n) ;
+}
+
+int donodegetreal(IDATAOBJECT *dh, enum dataobject_type type, double *data)
+{
+  return _do_getreal(dh, type, data) ;
+}
+
+char * donodegetdata(IDATAOBJECT *dh, enum dataobject_type type, int *datalen)
+{
+  return _do_getdata(dh, type, datalen) ;
+}
+
+int donodesetuint(IDATAOBJECT *dh, enum dataobject_type type, unsigned long int data)
+{
+  assert (type==do_uint32 || type==do_uint64 || type==do_bool || type==do_enum ||
+      type==do_64bit || type==do_fixed64 || type==do_32bit || type==do_fixed32) ;
+  return _do_setnode(dh, type, data, NULL, 0) ;
+}
+
+int donodesetsint(IDATAOBJECT *dh, enum dataobject_type type, signed long int data)
+{
+  assert(type==do_sint32 || type==do_sfixed32 || type==do_sint64 || type==do_sfixed64) ;
+  return _do_setnode(dh, type, _do_signedencode(data), NULL, 0) ;
+}
+
+int donodesetreal(IDATAOBJECT *dh, enum dataobject_type type, double data)
+{
+  switch (type) {
+  case do_float:
+    return _do_setnode(dh, type, _do_floatencode(data), NULL, 1) ;
+  case do_double:
+    return _do_setnode(dh, type, _do_doubleencode(data), NULL, 1) ;
+  default:
+    assert(!type) ;
+    return 0 ;
+  }
+}
+
+int donodesetdata(IDATAOBJECT *dh, enum dataobject_type type, char *data, int datalen)
+{
+  assert(type==do_string || type==do_data) ;
+  return _do_setnode(dh, type, 0, data, datalen) ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of a protobuf field by number, without
+//        producing or comparing its label
+// @param(in) dh DATAOBJECT handle (start of the chain to search)
+// @param(in) fieldnum Field number
+// @return handle of field, or NULL if not found
+//
+
+IDATAOBJECT * dogetfield(IDATAOBJECT *dh, int fieldnum)
+{
+  if (!dh || fieldnum<0 || fieldnum>DO_KEYMAX) return NULL ;
+
+  IDATAOBJECT *tail = NULL ;
+  IDATAOBJECT *node = _do_chainfind(dh, NULL, (long int)fieldnum<<2 | DO_KEY_FIELD, _do_ishead(dh), &tail) ;
+  if (!node || !_do_haslabel(node)) return NULL ;
+
+  return node ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the handle of an entry in an array by position
+// @param(in) dh DATAOBJECT handle
+// @param(in) path Path to the array
+// @param(in) i Position of entry (from 0)
+// @return handle of entry, or NULL if not found
+//
+
+IDATAOBJECT * dogetindex(IDATAOBJECT *dh, char *path, int i)
+{
+  IDATAOBJECT *node = _do_search(dh, path, 0) ;
+  if (!node || !node->child || i<0) return NULL ;
+
+  IDOCHAIN *c = _do_chainindex(node->child, 1) ;
+  if (!c || i>=c->count) return NULL ;
+
+  return c->items[i] ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the number of entries in an array
+// @param(in) dh DATAOBJECT handle
+// @param(in) path Path to the array
+// @return Number of entries, or -1 if path is not found
+//
+
+int dosize(IDATAOBJECT *dh, char *path)
+{
+  IDATAOBJECT *node = _do_search(dh, path, 0) ;
+  if (!node) return -1 ;
+  if (!node->child) return 0 ;
+
+  IDOCHAIN *c = _do_chainindex(node->child, 0) ;
+  if (!c) return -1 ;
+
+  return c->count ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Compiles a path for repeated use.  The path is split
+//        into its components, and the length and hash of each is
+//        calculated, in a single allocation.
+// @param(in) path Path to compile
+// @return Compiled path, or NULL on error
+//
+
+IDOPATH * docompilepath(char *path)
+{
+  if (!path) return NULL ;
+
+  // Count the components, and the space needed for them
+
+  int n = 0 ;
+  int len = 0 ;
+
+  for (char *s = path; *s; ) {
+    while (*s=='/') s++ ;
+    if (*s=='\0') break ;
+    int l ;
+    for (l=0; s[l]!='\0' && s[l]!='/'; l++) ;
+    n++ ;
+    len += l+1 ;
+    s += l ;
+  }
+
+  if (n==0) {
+    fprintf(stderr, "docompilepath: empty path\n") ;
+    return NULL ;
+  }
+
+  IDOPATH *p = malloc(sizeof(IDOPATH) + n * sizeof(IDOPATHCOMPONENT) + len) ;
+  if (!p) return NULL ;
+
+  p->ncomponents = n ;
+  char *str = (char *)&(p->component[n]) ;
+
+  n = 0 ;
+  for (char *s = path; *s; ) {
+    while (*s=='/') s++ ;
+    if (*s=='\0') break ;
+    int l ;
+    for (l=0; s[l]!='\0' && s[l]!='/'; l++) ;
+    memcpy(str, s, l) ;
+    str[l] = '\0' ;
+    p->component[n].str = str ;
+    p->component[n].len = l ;
+    p->component[n].hash = _do_hash(s, l) ;
+    p->component[n].key = _do_labelkey(s, l, 1) ;
+    n++ ;
+    str += l+1 ;
+    s += l ;
+  }
+
+  return p ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Frees a compiled path
+// @param(in) p Compiled path (or NULL)
+//
+
+void dofreepath(IDOPATH *p)
+{
+  free(p) ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Versions of dofindnode, dogetnode, doget* and doset*
+//        which take a compiled path
+//
+
+IDATAOBJECT * dofindnode_p(IDATAOBJECT *dh, IDOPATH *p)
+{
+  return _do_searchpath(dh, p, 0) ;
+}
+
+IDATAOBJECT * dogetnode_p(IDATAOBJECT *dh, IDOPATH *p)
+{
+  return _do_searchpath(dh, p, 1) ;
+}
+
+int dogetuint_p(IDATAOBJECT *dh, enum dataobject_type type, unsigned long int *n, IDOPATH *p)
+{
+  return _do_getuint(_do_searchpath(dh, p, 0), type, n) ;
+}
+
+int dogetsint_p(IDATAOBJECT *dh, enum dataobject_type type, long int *n, IDOPATH *p)
+{
+  return _do_getsint(_do_searchpath(dh, p, 0), type, n) ;
+}
+
+int dogetreal_p(IDATAOBJECT *dh, enum dataobject_type type, double *data, IDOPATH *p)
+{
+  return _do_getreal(_do_searchpath(dh, p, 0), type, data) ;
+}
+
+char * dogetdata_p(IDATAOBJECT *dh, enum dataobject_type type, int *datalen, IDOPATH *p)
+{
+  return _do_getdata(_do_searchpath(dh, p, 0), type, datalen) ;
+}
+
+int dosetuint_p(IDATAOBJECT *dh, enum dataobject_type type, unsigned long int data, IDOPATH *p)
+{
+  return donodesetuint(_do_searchpath(dh, p, 1), type, data) ;
+}
+
+int dosetsint_p(IDATAOBJECT *dh, enum dataobject_type type, signed long int data, IDOPATH *p)
+{
+  return donodesetsint(_do_searchpath(dh, p, 1), type, data) ;
+}
+
+int dosetreal_p(IDATAOBJECT *dh, enum dataobject_type type, double data, IDOPATH *p)
+{
+  if (type!=do_float && type!=do_double) return 0 ;
+  return donodesetreal(_do_searchpath(dh, p, 1), type, data) ;
+}
+
+int dosetdata_p(IDATAOBJECT *dh, enum dataobject_type type, char *data, int datalen, IDOPATH *p)
+{
+  return donodesetdata(_do_searchpath(dh, p, 1), type, data, datalen) ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Sets many items, searching each path from where the
+//        previous one left off
+// @param(in) dh DATAOBJECT handle
+// @param(in) entries Items to set
+// @param(in) n Number of entries
+// @return Number of entries which were set
+//
+
+int dosetmany(IDATAOBJECT *dh, const dobatch_entry *entries, int n)
+{
+  if (!dh || !entries) {
+    fprintf(stderr, "dosetmany: called with NULL handle\n") ;
+    return 0 ;
+  }
+
+  IDOTRAIL trail ;
+  trail.depth = 0 ;
+
+  int count = 0 ;
+
+  for (int i=0; i<n; i++) {
+
+    const dobatch_entry *e = &entries[i] ;
+    int ok ;
+
+    switch (e->type) {
+
+    case do_sint32:
+    case do_sint64:
+    case do_sfixed32:
+    case do_sfixed64:
+      ok = _do_setnode(_do_searchtrail(dh, e->path, 1, &trail), e->type, _do_signedencode(e->s), NULL, 0) ;
+      break ;
+
+    case do_float:
+      ok = _do_setnode(_do_searchtrail(dh, e->path, 1, &trail), e->type, _do_floatencode(e->real), NULL, 1) ;
+      break ;
+
+    case do_double:
+      ok = _do_setnode(_do_searchtrail(dh, e->path, 1, &trail), e->type, _do_doubleencode(e->real), NULL, 1) ;
+      break ;
+
+    case do_string:
+    case do_data:
+      ok = _do_setnode(_do_searchtrail(dh, e->path, 1, &trail), e->type, 0, e->data, e->datalen) ;
+      break ;
+
+    case do_node:
+    case do_unknown:
+      ok = 0 ;
+      break ;
+
+    default:
+      ok = _do_setnode(_do_searchtrail(dh, e->path, 1, &trail), e->type, e->u, NULL, 0) ;
+      break ;
+
+    }
+
+    if (ok) count++ ;
+
+  }
+
+  return count ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Gets many items, searching each path from where the
+//        previous one left off
+// @param(in) dh DATAOBJECT handle
+// @param(in/out) entries Items to get
+// @param(in) n Number of entries
+// @return Number of entries which were found
+//
+
+int dogetmany(IDATAOBJECT *dh, dobatch_entry *entries, int n)
+{
+  if (!dh || !entries) {
+    fprintf(stderr, "dogetmany: called with NULL handle\n") ;
+    return 0 ;
+  }
+
+  IDOTRAIL trail ;
+  trail.depth = 0 ;
+
+  int count = 0 ;
+
+  for (int i=0; i<n; i++) {
+
+    dobatch_entry *e = &entries[i] ;
+    IDATAOBJECT *node = _do_searchtrail(dh, e->path, 0, &trail) ;
+
+    switch (e->type) {
+
+    case do_sint32:
+    case do_sint64:
+    case do_sfixed32:
+    case do_sfixed64:
+      e->ok = _do_getsint(node, e->type, &(e->s)) ;
+      break ;
+
+    case do_float:
+    case do_double:
+      e->ok = _do_getreal(node, e->type, &(e->real)) ;
+      break ;
+
+    case do_string:
+    case do_data:
+      e->data = _do_getdata(node, e->type, &(e->datalen)) ;
+      e->ok = (node!=NULL) ;
+      break ;
+
+    default:
+      e->ok = _do_getuint(node, e->type, &(e->u)) ;
+      break ;
+
+    }
+
+    if (e->ok) count++ ;
+
+  }
+
+  return count ;
+}
+
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds the node matching one path component within a chain
+// @param(in) nh Node to start from
+// @param(in) ishead True if nh is known to be the head of its chain
+// @param(in) label Interned label of component (or NULL if the
+//            tree does not use it)
+// @param(in) key Integer key of component, or -1
+// @param(in) s Path component
+// @param(in) l Length of path component
+// @param(out) tail Set to the last node in the chain if no match
+//             is found, or NULL on error
+// @return Matching node, or NULL if not found / error
+//
+
+static IDATAOBJECT *_do_searchmatch(IDATAOBJECT *nh, int ishead, char *label, long int key, char *s, int l, IDATAOBJECT **tail)
+{
+  IDATAOBJECT *match = _do_chainfind(nh, label, key, ishead, tail) ;
+
+  // "#n" matches a literal label "#n" if no entry has that number
+
+  if (!match && key>=0 && (key&3)==DO_KEY_ANY) {
+    char *hashlabel = _do_labelfind(nh->ctx, s, l) ;
+    if (hashlabel) match = _do_chainfind(nh, hashlabel, -1, ishead, tail) ;
+  }
+
+  // '+' matches the last entry of an array
+
+  if (!match && l==1 && *s=='+' && _do_isindex(*tail)) match = *tail ;
+
+  // Use first (unlabelled) entry
+
+  if (match && !_do_haslabel(match)) {
+    if (!_do_labelnode(match, s, l, key)) {
+      *tail = NULL ;
+      return NULL ;
+    }
+  }
+
+  return match ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Steps down from a matched node to its child
+// @param(in) match Node to descend from
+// @param(in) forcecreate If true, a child is created if needed
+// @return Child, or NULL if there isn't one / error
+//
+
+static IDATAOBJECT *_do_searchdescend(IDATAOBJECT *match, int forcecreate)
+{
+  if (!match->child) {
+
+    // Descending through a record turns it into a node
+
+    if (!forcecreate) return NULL ;
+    if (!_do_newchild(match)) return NULL ;
+    _do_cleardata(match) ;
+    match->d1 = 0 ;
+    match->type = do_node ;
+
+  }
+
+  return match->child ;
+}
+
+
 ///////////////////////////////////////////////////////////
 //
-// @brief Gets the handle of a node at the given path, and create if not exiting
-// @param(in) dh IDATAOBJECT handler
-// @param(in) path Path in dh to get
-// @return handle of the node
+// @brief Creates a node for a path component which was not
+//        found, either at the end of a chain or (when creating
+//        the rest of the path) as the child of the previous one
+// @param(in) ctx Tree context
+// @param(in) prev Tail of the chain, or parent node
+// @param(in) head Head of the chain if known, or NULL
+// @param(in) aschild If true, the node is the child of prev
+// @param(in) s Path component
+// @param(in) l Length of path component
+// @param(in) key Integer key of component, or -1
+// @return New node, or NULL on error
+//
 
-IDATAOBJECT * dogetnode(IDATAOBJECT *dh, char *path)
+static IDATAOBJECT *_do_searchappend(IDOCONTEXT *ctx, IDATAOBJECT *prev, IDATAOBJECT *head, int aschild, char *s, int l, long int key)
 {
-  return _do_search(dh, path, 1) ;
+  IDATAOBJECT *n = _do_newnode(ctx) ;
+  if (!n) return NULL ;
+
+  if (!_do_labelnode(n, s, l, key)) {
+    _do_freenode(n) ;
+    return NULL ;
+  }
+  n->type = do_node ;
+
+  if (aschild) {
+    n->flags |= DO_F_HEAD ;
+    prev->child = n ;
+  } else {
+    prev->next = n ;
+    _do_chainadd(head, n) ;
+  }
+
+  return n ;
 }
 
 
-///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
-// @brief Gets the handle of a node at the given path
-// @param(in) dh IDATAOBJECT handler
-// @param(in) path Path in dh to get
-// @return handle of the node
+// @brief Records the node found for a path component in a trail
+// @param(in) trail Trail (or NULL)
+// @param(in) depth Index of component
+// @param(in) s Path component
+// @param(in) l Length of path component
+// @param(in) node Node found / created
+//
 
-IDATAOBJECT * dofindnode(IDATAOBJECT *dh, char *path)
+static void _do_trailpush(IDOTRAIL *trail, int depth, char *s, int l, IDATAOBJECT *node)
 {
-  return _do_search(dh, path, 0) ;
+  if (!trail || depth!=trail->depth || depth>=DO_TRAILDEPTH) return ;
+
+  trail->str[depth] = s ;
+  trail->len[depth] = l ;
+  trail->node[depth] = node ;
+  trail->depth = depth+1 ;
 }
 
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
-// @brief Gets the handle of a node's child
-// @param(in) dh DATAOBJECT handler
-// @return handle of new node created
+// @brief Finds (or creates) the node at a path
+// @param(in) root Node to search from
+// @param(in) path Path to node
+// @param(in) forcecreate If true, missing nodes are created
+// @return Node, or NULL if not found / error
+//
 
-IDATAOBJECT * dochild(DATAOBJECT *dh) 
+IDATAOBJECT *_do_search(IDATAOBJECT *root, char *path, int forcecreate)
 {
-  if (!dh) return NULL ;
-  else return dh->child ;
+  return _do_searchtrail(root, path, forcecreate, NULL) ;
 }
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Finds (or creates) the node at a path, starting from
+//        where the previous search with the same trail left off.
+//        The components which the path shares with the previous
+//        path are not searched again, and the trail is updated
+//        with the nodes found for the path.  The tree must not be
+//        restructured between searches with the same trail.
+// @param(in) root Node to search from (the same for each search)
+// @param(in) path Path to node
+// @param(in) forcecreate If true, missing nodes are created
+// @param(in/out) trail Nodes found by the previous search (depth
+//                0 to start), or NULL
+// @return Node, or NULL if not found / error
+//
 
-IDATAOBJECT *_do_search(IDATAOBJECT *root, char *path, int forcecreate)
+IDATAOBJECT *_do_searchtrail(IDATAOBJECT *root, char *path, int forcecreate, IDOTRAIL *trail)
 {
 
   if (!root || !path) return NULL ;
 
   IDATAOBJECT *nh = root ;
+  IDOCONTEXT *ctx = root->ctx ;
+  int depth = 0 ;
+
+  // The root of the tree and children are the heads of their
+  // chains, so can use / build an index
+
+  int ishead = _do_ishead(root) ;
 
   while (*path=='/') path++ ;
+  if (*path=='\0') return NULL ;
 
-  do {
+  if (trail) {
 
-    if ( ( *path!='\0' &&  nh->label &&  _do_strtcmp(path, nh->label, '/') ) ||
-         ( *path!='\0' && !nh->label ) ||
-         ( *path=='+' && isdigit(nh->label[0]) && nh->next==NULL ) ) {
+    // Skip the components shared with the previous path
 
-      // Use first entry
+    while (depth < trail->depth) {
 
-      if (!nh->label) {
-        int p ;
-        for (p=0; path[p]!='\0' && path[p]!='/'; p++) ;
-        nh->label=malloc(p+1) ;
-        strncpy(nh->label, path, p) ; nh->label[p]='\0' ;
-      }
-      
-      // Match found
+      int l ;
+      for (l=0; path[l]!='\0' && path[l]!='/'; l++) ;
+      if (l!=trail->len[depth] || memcmp(path, trail->str[depth], l)!=0) break ;
 
-      path += strlen(nh->label) ;
+      path += l ;
       while (*path=='/') path++ ;
+      depth++ ;
 
       if (*path=='\0') {
+        trail->depth = depth ;
+        return trail->node[depth-1] ;
+      }
 
-        // At the end of the path
-        return nh ;
+    }
 
-      }
+    trail->depth = depth ;
 
+    if (depth>0) {
+      nh = _do_searchdescend(trail->node[depth-1], forcecreate) ;
+      if (!nh) return NULL ;
+      ishead = 1 ;
+    }
+
+  }
 
-      if (nh->child) { 
+  while (1) {
 
-        // Descend
+    // Length of the current path component, and its interned
+    // label (NULL if no node in the tree has that label)
 
-        nh = nh->child ;
+    int l ;
+    for (l=0; path[l]!='\0' && path[l]!='/'; l++) ;
+    long int key = _do_labelkey(path, l, 1) ;
+    char *label = (key<0) ? _do_labelfind(ctx, path, l) : NULL ;
 
-      }
+    IDATAOBJECT *tail = NULL ;
+    IDATAOBJECT *match = _do_searchmatch(nh, ishead, label, key, path, l, &tail) ;
+    if (!match && !tail) goto fail ;
 
+    char *component = path ;
+    path += l ;
+    while (*path=='/') path++ ;
 
-    } else if (nh->next) {
+    if (match) {
 
-      // Match not found, progress along chain
+      _do_trailpush(trail, depth++, component, l, match) ;
 
-      nh=nh->next ;
-      //entrynum++ ;
+      // At the end of the path
 
-    } else if (forcecreate && *path!='\0') {
+      if (*path=='\0') return match ;
+
+      // Descend
+
+      nh = _do_searchdescend(match, forcecreate) ;
+      if (!nh) return NULL ;
+      ishead = 1 ;
+
+    } else if (forcecreate) {
 
       // Match not found at end of chain, so attach
       // hierarchy to the end of the chain
 
-      nh->next = donew() ;
-      if (!nh->next) goto fail ;
-      nh = nh->next ;
+      IDATAOBJECT *n = _do_searchappend(ctx, tail, ishead ? nh : NULL, 0, component, l, key) ;
+      if (!n) goto fail ;
+      _do_trailpush(trail, depth++, component, l, n) ;
 
-      while (*path!='\0') {
+      while (n && *path!='\0') {
 
-        int l ;
         for (l=0; path[l]!='\0' && path[l]!='/'; l++) ;
-
-        nh->label = malloc(l+1) ;
-        if (!nh->label) goto fail ;
-        strncpy(nh->label, path, l) ; nh->label[l]='\0' ; 
-
-        nh->type = do_node ;
+        n = _do_searchappend(ctx, n, NULL, 1, path, l, _do_labelkey(path, l, 1)) ;
+        if (n) _do_trailpush(trail, depth++, path, l, n) ;
         path += l ;
         while (*path=='/') path++ ;
 
-        if (*path!='\0') {
-          nh->child = donew() ;
-          if (!nh->child) goto fail ;
-          nh = nh->child ;
-        }
-
       }
 
+      return n ;
+
     } else {
 
       // At end of chain and match not found
@@ -317,10 +1079,7 @@ IDATAOBJECT *_do_search(IDATAOBJECT *root, char *path, int forcecreate)
       return NULL ;
     }
 
-
-  } while (*path!='\0') ;
-
-  return nh ;
+  }
 
 fail:
   return NULL ;
@@ -328,6 +1087,66 @@ fail:
 }
 
 
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Finds (or creates) the node at a compiled path, as
+//        _do_search
+// @param(in) root Node to search from
+// @param(in) p Compiled path
+// @param(in) forcecreate If true, missing nodes are created
+// @return Node, or NULL if not found / error
+//
+
+IDATAOBJECT *_do_searchpath(IDATAOBJECT *root, IDOPATH *p, int forcecreate)
+{
+  if (!root || !p || p->ncomponents==0) return NULL ;
+
+  IDATAOBJECT *nh = root ;
+  IDOCONTEXT *ctx = root->ctx ;
+  int ishead = _do_ishead(root) ;
+
+  for (int i=0; i<p->ncomponents; i++) {
+
+    IDOPATHCOMPONENT *pc = &(p->component[i]) ;
+
+    // The label's hash is already known
+
+    char *label = (pc->key<0) ? _do_labelfindhash(ctx, pc->str, pc->len, pc->hash) : NULL ;
+
+    IDATAOBJECT *tail = NULL ;
+    IDATAOBJECT *match = _do_searchmatch(nh, ishead, label, pc->key, pc->str, pc->len, &tail) ;
+    if (!match && !tail) return NULL ;
+
+    if (match) {
+
+      if (i==p->ncomponents-1) return match ;
+
+      nh = _do_searchdescend(match, forcecreate) ;
+      if (!nh) return NULL ;
+      ishead = 1 ;
+
+    } else if (forcecreate) {
+
+      IDATAOBJECT *n = _do_searchappend(ctx, tail, ishead ? nh : NULL, 0, pc->str, pc->len, pc->key) ;
+      for (i++; n && i<p->ncomponents; i++) {
+        pc = &(p->component[i]) ;
+        n = _do_searchappend(ctx, n, NULL, 1, pc->str, pc->len, pc->key) ;
+      }
+      return n ;
+
+    } else {
+
+      return NULL ;
+
+    }
+
+  }
+
+  return NULL ;
+}
+
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
@@ -339,7 +1158,9 @@ fail:
 
 int dorenamenode(IDATAOBJECT *dh, char *path, char *newname) 
 {
-  IDATAOBJECT *node = dofindnode(dh, path) ;
+  IDOTRAIL trail ;
+  trail.depth = 0 ;
+  IDATAOBJECT *node = _do_searchtrail(dh, path, 0, &trail) ;
   
   if (!node) return 0 ;
   if (strstr(newname, "/")!=NULL) {
@@ -347,10 +1168,21 @@ int dorenamenode(IDATAOBJECT *dh, char *path, char *newname)
     return 0 ;
   }
 
-  if (node->label) free(node->label) ;
-  node->label = malloc(strlen(newname)+1) ;
-  if (!node->label) return 0 ;
-  strcpy(node->label, newname) ;
+  int len = strlen(newname) ;
+  long int key = _do_labelkey(newname, len, 0) ;
+
+  char *label = (key<0) ? _do_labelintern(node->ctx, newname, len) : NULL ;
+  if (!label && key<0) return 0 ;
+
+  // The head of the node's chain is the child of the node above
+  // it, or dh itself for a top level node
+
+  IDATAOBJECT *head = NULL ;
+  if (trail.depth>1 && trail.node[trail.depth-1]==node) head = trail.node[trail.depth-2]->child ;
+  else if (trail.depth==1 && trail.node[0]==node && _do_ishead(dh)) head = dh ;
+
+  _do_chainrelabel(head, node, label, key) ;
+
   return 1 ;
 }
 
@@ -394,54 +1226,77 @@ int _do_pastecopy(IDATAOBJECT *dest, IDATAOBJECT *rootdest, IDATAOBJECT *src, in
 
   if (!dest || !src) return 0 ;
 
-  IDATAOBJECT *d=dest, *s=src ;
+  IDATAOBJECT *s=src ;
 
-  while (s && s->label) {
+  // Children are always chain heads
 
-    IDATAOBJECT *d = dest ;
+  int ishead = (level>0 || _do_ishead(dest)) ;
 
-    // Search for matching entry
+  while (s && _do_haslabel(s)) {
 
-    int found=0 ;
-    do {
-      if (d->label && strcmp(d->label, s->label)==0) {
-        found=1 ;
-      } else if (d->next) {
-        d = d->next ;
-      }
-    } while ( d->next && !found  ) ;
+    // Search for matching entry (or an unlabelled one to use)
+
+    // Keys and labels in the same tree are interned, so only need
+    // a string compare when pasting a label from another tree
+
+    int samectx = (dest->ctx==s->ctx) ;
+    long int skey = _do_nodekey(s) ;
+    char *slabel = (skey>=0) ? NULL :
+                   samectx ? s->label : _do_labelfind(dest->ctx, s->label, _do_labellen(s->label)) ;
+
+    IDATAOBJECT *tail = NULL ;
+    IDATAOBJECT *d = _do_chainfind(dest, slabel, skey, ishead, &tail) ;
 
     // Trap attempts to copy self
 
     if (s == rootdest && level != 0 ) { return 1 ; }
 
-    // Create blank entry if none found
+    // Create and copy label if not found
 
-    if (!found && d->label) {
-      d->next = donew() ;
-      if (!d->next) goto fail ;
-      d=d->next ;
-    }
+    if (!d || !_do_haslabel(d)) {
 
-    // Create and copy label if not found
+      char *label = NULL ;
+      if (skey<0) {
+        label = samectx ? _do_labelref(s->label) :
+                          _do_labelintern(dest->ctx, s->label, _do_labellen(s->label)) ;
+        if (!label) goto fail ;
+      }
+
+      if (!d) {
+
+        // Create entry at the end of the chain
+
+        d = _do_newnode(dest->ctx) ;
+        if (!d) {
+          _do_labelrelease(dest->ctx, label) ;
+          goto fail ;
+        }
+        d->label = label ;
+        if (skey>=0) _do_setkey(d, skey) ;
+        tail->next = d ;
+        _do_chainadd(ishead ? dest : NULL, d) ;
+
+      } else {
+
+        d->label = label ;
+        if (skey>=0) _do_setkey(d, skey) ;
+
+      }
 
-    if (!d->label) {
-      d->label = malloc(strlen(s->label)+1) ;
-      if (!d->label) goto fail ;
-      strcpy(d->label, s->label) ;
     }
 
     // Copy d1
 
 
-    d->d1 = s->d1 ;
-
     // Copy data / d2
 
-    if (s->d2) {
-      d->d2 = malloc(d->d1) ;
-      if (!d->d2) goto fail ;
-      memcpy(d->d2, s->d2, d->d1) ;
+    if (d!=s) {
+      if (_do_hasd2(s)) {
+        if (!_do_setdata(d, _do_d2(s), s->d1)) goto fail ;
+      } else {
+        _do_cleardata(d) ;
+        d->d1 = s->d1 ;
+      }
     }
 
     // Copy type
@@ -451,11 +1306,7 @@ int _do_pastecopy(IDATAOBJECT *dest, IDATAOBJECT *rootdest, IDATAOBJECT *src, in
     // Recurse to child
 
     if (s->child) {
-      if (d->child) {
-      } else {
-        d->child = donew() ;
-        if (!d->child) goto fail ;
-      }
+      if (!d->child && !_do_newchild(d)) goto fail ;
       _do_pastecopy(d->child, rootdest, s->child, level+1) ;
     }
 
@@ -519,7 +1370,6 @@ int dosetsint(IDATAOBJECT *dh, enum dataobject_type type, signed long int data,
   assert(path) ;
   assert(type==do_sint32 || type==do_sfixed32 || type==do_sint64 || type==do_sfixed64) ;
 
-  unsigned long int udata ;
   int r ;
 
   switch(type) {
@@ -582,7 +1432,7 @@ int dosetdata(IDATAOBJECT *dh, enum dataobject_type type, char *data, int datale
 // @return True on success
 //
 
-int dosettreal(IDATAOBJECT *dh, enum dataobject_type type, double data, char *path) 
+int dosetreal(IDATAOBJECT *dh, enum dataobject_type type, double data, char *path) 
 {
   if (!dh) {
     fprintf(stderr, "dosetdouble: called with NULL handle\n") ;
@@ -601,6 +1451,7 @@ int dosettreal(IDATAOBJECT *dh, enum dataobject_type type, double data, char *pa
     break ;
   }
 
+  return 0 ;
 }
 
 ///////////////////////////////////////////////////////////
@@ -623,7 +1474,7 @@ int dosettype(IDATAOBJECT *dh, enum dataobject_type type, char *path)
 
   // If changing type to data, but no data present, fail
 
-  if ((type==do_data || type==do_string) && !node->d2) return 0 ;
+  if ((type==do_data || type==do_string) && !_do_hasd2(node)) return 0 ;
 
   // Set type
 
@@ -631,12 +1482,11 @@ int dosettype(IDATAOBJECT *dh, enum dataobject_type type, char *path)
 
   // If no longer a string, free data
 
-  if (type!=do_data && type!=do_string && node->d2) {
-    free(node->d2) ;
-    node->d2 = 0 ;
+  if (type!=do_data && type!=do_string && _do_hasd2(node)) {
+    _do_cleardata(node) ;
   }
 
-  return 0 ;
+  return 1 ;
 }
 
 
@@ -654,12 +1504,27 @@ int dosettype(IDATAOBJECT *dh, enum dataobject_type type, char *path)
 
 int dogetuint(IDATAOBJECT *dh, enum dataobject_type type, unsigned long int *n, char *path)
 {
-  IDATAOBJECT *node = dofindnode(dh, path) ;
+  return _do_getuint(dofindnode(dh, path), type, n) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the contents of a node as an unsigned int
+// @param(in) node Node (or NULL, which fails)
+// @param(in) type Record type
+// @param(out) n Pointer to location to store results
+// @return True on success
+//
+
+int _do_getuint(IDATAOBJECT *node, int type, unsigned long int *n)
+{
   if (!node) return 0 ;
 
   switch (node->type) {
   case do_64bit:
   case do_32bit:
+  case do_bool:
   case do_enum:
   case do_uint32:
   case do_uint64:
@@ -679,13 +1544,15 @@ int dogetuint(IDATAOBJECT *dh, enum dataobject_type type, unsigned long int *n,
   case do_sint32:
   case do_sint64:
   case do_sfixed32:
-  case do_sfixed64:
+  case do_sfixed64: {
 
     // discard sign and return
 
-    (*n) = (node->d1 >> 1) ;
+    signed long int v = _do_signeddecode(node->d1) ;
+    (*n) = (v<0) ? 0-(unsigned long int)v : (unsigned long int)v ;
     return 1 ;
     break ;
+  }
 
   case do_float: {
 
@@ -735,13 +1602,28 @@ int dogetuint(IDATAOBJECT *dh, enum dataobject_type type, unsigned long int *n,
 
 long int dogetsint(IDATAOBJECT *dh, enum dataobject_type type,  long int *n, char *path)
 {
-  IDATAOBJECT *node = dofindnode(dh, path) ;
+  return _do_getsint(dofindnode(dh, path), type, n) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the contents of a node as a signed int
+// @param(in) node Node (or NULL, which fails)
+// @param(in) type Record type
+// @param(out) n Pointer to location to store results
+// @return True on success
+//
+
+int _do_getsint(IDATAOBJECT *node, int type, long int *n)
+{
   if (!node) return 0 ;
 
   switch (node->type) {
 
   case do_64bit:
   case do_32bit:
+  case do_bool:
   case do_enum:
   case do_uint32:
   case do_uint64:
@@ -810,10 +1692,24 @@ long int dogetsint(IDATAOBJECT *dh, enum dataobject_type type,  long int *n, cha
 
 char * dogetdata(IDATAOBJECT *dh, enum dataobject_type type, int *datalen, char *path) 
 {
-  IDATAOBJECT *h = _do_search(dh, path, 0) ;
+  return _do_getdata(_do_search(dh, path, 0), type, datalen) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the data held in a node
+// @param(in) h Node (or NULL, which fails)
+// @param(in) type Record type
+// @param(out) datalen Set to length of data (if not NULL)
+// @return Pointer to data or NULL if not found
+//
+
+char *_do_getdata(IDATAOBJECT *h, int type, int *datalen)
+{
   if (!h) return NULL ;
   if (datalen) (*datalen) = h->d1 ;
-  return h->d2 ;
+  return _do_d2(h) ;
 }
 
 
@@ -830,7 +1726,21 @@ char * dogetdata(IDATAOBJECT *dh, enum dataobject_type type, int *datalen, char
 
 int dogetreal(IDATAOBJECT *dh, enum dataobject_type type, double *data, char *path)
 {
-  IDATAOBJECT *node = dofindnode(dh, path) ;
+  return _do_getreal(dofindnode(dh, path), type, data) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets the contents of a node as a real number
+// @param(in) node Node (or NULL, which fails)
+// @param(in) type Record type
+// @param(out) data Pointer to double to store result
+// @return True on success
+//
+
+int _do_getreal(IDATAOBJECT *node, int type, double *data)
+{
   if (!node) return 0 ;
 
   switch (node->type) {
@@ -924,7 +1834,6 @@ enum dataobject_type dogettype(IDATAOBJECT *dh, char *path)
 // @param(in) ldata Unsigned long data
 // @param(in) data String data (or NULL)
 // @param(in) datalen Length of String data
-// @param(in) fdata Float data
 // @param(in) path Path at which data is to be stored
 // @return true on success
 //
@@ -939,7 +1848,23 @@ int _do_set(IDATAOBJECT *dh, int type, unsigned long int ldata, char *data, int
     return 0 ;
   }
 
-  IDATAOBJECT *h = dogetnode(dh, path) ;
+  return _do_setnode(dogetnode(dh, path), type, ldata, data, datalen) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Set data type within a node
+// @param(in) h Node (or NULL, which fails)
+// @param(in) type Type of data to set
+// @param(in) ldata Unsigned long data
+// @param(in) data String data (or NULL)
+// @param(in) datalen Length of String data
+// @return true on success
+//
+
+int _do_setnode(IDATAOBJECT *h, int type, unsigned long int ldata, char *data, int datalen)
+{
   if (!h) goto fail ;
 
   // Store the data
@@ -951,27 +1876,17 @@ int _do_set(IDATAOBJECT *dh, int type, unsigned long int ldata, char *data, int
   case do_string:
   case do_data:
 
-    if (h->d2) {
-      free(h->d2) ;
-      h->d2 = NULL ;
-      h->d1 = 0 ;
-    }
-
     if (data && datalen>=0) {
-      h->d2 = malloc(datalen + 1) ;
-      if (!h->d2) goto fail ;
-      memcpy(h->d2, data, datalen) ;
-      h->d2[datalen]='\0' ;
-      h->d1 = datalen ;
+      if (!_do_setdata(h, data, datalen)) goto fail ;
+    } else {
+      _do_cleardata(h) ;
+      h->d1 = 0 ;
     }
     break ;
 
   default:
 
-    if (h->d2) {
-      free(h->d2) ;
-      h->d2=NULL ;
-    }
+    _do_cleardata(h) ;
 
     h->d1 = ldata ;
     break ;
@@ -985,6 +1900,139 @@ fail:
 
 }
 
+///////////////////////////////////////////////////////////
+//
+// @brief Stores a copy of string / binary data in a node, null
+//        terminated, and replacing any existing data
+// @param(in) h Node
+// @param(in) data Data to store
+// @param(in) datalen Length of data
+// @return true on success
+//
+
+int _do_setdata(IDATAOBJECT *h, char *data, int datalen)
+{
+  // Data is copied before the old data is released, as it may
+  // be a copy of itself
+
+  if (datalen < (int)sizeof(h->d2inline)) {
+
+    // Short enough to hold within the node
+
+    char d2[sizeof(h->d2inline)] ;
+    memcpy(d2, data, datalen) ;
+    _do_cleardata(h) ;
+    memcpy(h->d2inline, d2, datalen) ;
+    h->d2inline[datalen] = '\0' ;
+    h->flags |= DO_F_INLINE ;
+
+  } else {
+
+    char *d2 = _do_alloc(h->ctx, datalen + 1) ;
+    if (!d2) return 0 ;
+    memcpy(d2, data, datalen) ;
+    d2[datalen] = '\0' ;
+    _do_cleardata(h) ;
+    h->d2 = d2 ;
+
+  }
+
+  h->d1 = datalen ;
+
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Replaces a node's string / binary data with storage for
+//        datalen bytes (plus a terminating null) for the caller
+//        to fill in
+// @param(in) h Node
+// @param(in) datalen Length of data
+// @return pointer to storage, or NULL on error
+//
+
+char *_do_allocdata(IDATAOBJECT *h, int datalen)
+{
+  char *d2 ;
+
+  _do_cleardata(h) ;
+
+  if (datalen < (int)sizeof(h->d2inline)) {
+    d2 = h->d2inline ;
+    h->flags |= DO_F_INLINE ;
+  } else {
+    d2 = _do_alloc(h->ctx, datalen + 1) ;
+    if (!d2) return NULL ;
+    h->d2 = d2 ;
+  }
+
+  d2[datalen] = '\0' ;
+  h->d1 = datalen ;
+
+  return d2 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Shortens data allocated with _do_allocdata
+// @param(in) h Node
+// @param(in) datalen New length, which is no longer than the old
+// @return True on success
+//
+
+int _do_truncdata(IDATAOBJECT *h, int datalen)
+{
+  if (datalen >= (int)h->d1) return 1 ;
+
+  if (!(h->flags & DO_F_INLINE)) {
+
+    if (datalen < (int)sizeof(h->d2inline)) {
+
+      // Move into the node (d2 shares its space)
+
+      char d2[sizeof(h->d2inline)] ;
+      memcpy(d2, h->d2, datalen) ;
+      _do_cleardata(h) ;
+      memcpy(h->d2inline, d2, datalen) ;
+      h->flags |= DO_F_INLINE ;
+
+    } else {
+
+      char *d2 = _do_realloc(h->ctx, h->d2, h->d1+1, datalen+1) ;
+      if (!d2) return 0 ;
+      h->d2 = d2 ;
+
+    }
+  }
+
+  _do_d2(h)[datalen] = '\0' ;
+  h->d1 = datalen ;
+
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Releases string / binary data held by a node
+//        (d1 is left unchanged)
+// @param(in) h Node
+//
+
+void _do_cleardata(IDATAOBJECT *h)
+{
+  if (h->flags & (DO_F_INLINE|DO_F_BORROWED)) {
+    h->flags &= ~(DO_F_INLINE|DO_F_BORROWED) ;
+  } else if (h->d2) {
+    _do_free(h->ctx, h->d2, h->d1+1) ;
+  }
+  h->d2 = NULL ;
+}
+
+
 int _do_strtcmp(char *haystack, char *needle, char term)
 {
   while (*haystack == *needle && *needle!='\0' && *haystack!='\0') {
@@ -996,20 +2044,12 @@ int _do_strtcmp(char *haystack, char *needle, char term)
 
 unsigned long int _do_signedencode(signed long int n)
 {
-  if (n<0) {
-    return ( (-n) << 1) + 1 ;
-  } else {
-    return (n << 1) ;
-  }
+  return ((unsigned long int)n << 1) ^ (unsigned long int)(n >> 63) ;
 }
 
 signed long int _do_signeddecode(unsigned long int n)
 {
-  if (n&1) {
-    return -(signed int)( n>>1 ) ;
-  } else {
-    return (signed int)(n>>1) ;
-  }
+  return (signed long int)(n >> 1) ^ -(signed long int)(n & 1) ;
 }
 
 unsigned long int _do_floatencode(float f) 
@@ -0,0 +1,449 @@
+//
+// dataobject_alloc.c
+//
+// Memory management for dataobject trees
+//
+// Every tree has a context, which is allocated together
+// with the root node.  All nodes, labels, data and output
+// buffers belonging to the tree are allocated through the
+// context, either individually from the heap, or (in arena
+// mode) from chunks which are owned by the root, and which
+// are released all at once when the root is cleared or
+// deleted.
+//
+// Pool mode also allocates from chunks, but memory freed
+// when part of the tree is cleared goes onto size classed
+// free lists for re-use, and the chunks are kept when the
+// root is cleared, so a tree which is repeatedly cleared and
+// re-populated stops allocating from the heap.
+//
+
+#include <malloc.h>
+#include <string.h>
+#include <assert.h>
+
+
+#include "dataobject_private.h"
+#include "../dataobject.h"
+
+#define DO_CHUNKMIN 4096
+#define DO_CHUNKMAX (1024*1024)
+
+#define _do_align(n) ( ((n)+7) & ~7UL )
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Creates a tree context and its root node
+// @param(in) mode DO_MODE_HEAP, DO_MODE_ARENA or DO_MODE_POOL
+// @param(in) sizehint Size of first arena chunk (0 for default)
+// @return pointer to context or NULL on error
+//
+
+IDOCONTEXT *_do_newcontext(int mode, unsigned long int sizehint)
+{
+  IDOCONTEXT *ctx = malloc(sizeof(IDOCONTEXT)) ;
+  if (!ctx) return NULL ;
+
+  memset(ctx, '\0', sizeof(IDOCONTEXT)) ;
+  ctx->mode = mode ;
+  ctx->sizehint = (sizehint<DO_CHUNKMIN) ? DO_CHUNKMIN : _do_align(sizehint) ;
+  ctx->chunksize = ctx->sizehint ;
+
+  ctx->root.ctx = ctx ;
+  ctx->root.type = -1 ;
+  ctx->root.flags = DO_F_HEAD ;
+
+  return ctx ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Releases all arena chunks owned by the context.  Pool
+//        contexts keep the chunks for re-use, and empty their
+//        free lists.
+// @param(in) ctx Tree context
+//
+
+void _do_resetcontext(IDOCONTEXT *ctx)
+{
+  if (!ctx) return ;
+
+  IDOCHUNK *c = ctx->chunks ;
+  while (c) {
+    IDOCHUNK *next = c->next ;
+    if (ctx->mode==DO_MODE_POOL) {
+      c->used = 0 ;
+      c->next = ctx->spare ;
+      ctx->spare = c ;
+    } else {
+      free(c) ;
+    }
+    c = next ;
+  }
+
+  ctx->chunks = NULL ;
+  ctx->chunksize = ctx->sizehint ;
+
+  ctx->freenodes = NULL ;
+  memset(ctx->freelist, '\0', sizeof(ctx->freelist)) ;
+
+  // Chain indexes have gone too
+
+  ctx->nchains = 0 ;
+  ctx->chains = NULL ;
+
+  // Any interned labels have gone with the chunks
+
+  if (ctx->mode!=DO_MODE_HEAP) _do_labelreset(ctx) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Releases the context (the tree must already be clear)
+// @param(in) ctx Tree context
+//
+
+void _do_freecontext(IDOCONTEXT *ctx)
+{
+  if (!ctx) return ;
+
+  _do_resetcontext(ctx) ;
+
+  IDOCHUNK *c = ctx->spare ;
+  while (c) {
+    IDOCHUNK *next = c->next ;
+    free(c) ;
+    c = next ;
+  }
+
+  free(ctx->labels) ;
+  free(ctx->pbsizes) ;
+  free(ctx->jsonindex) ;
+  free(ctx) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets an empty chunk, re-using a spare one if possible
+// @param(in) ctx Tree context
+// @param(in) size Minimum size of chunk
+// @return pointer to chunk or NULL on error
+//
+
+static IDOCHUNK *_do_getchunk(IDOCONTEXT *ctx, unsigned long int size)
+{
+  IDOCHUNK **pc = &(ctx->spare) ;
+
+  while (*pc) {
+    if ((*pc)->size >= size) {
+      IDOCHUNK *c = *pc ;
+      *pc = c->next ;
+      c->used = 0 ;
+      return c ;
+    }
+    pc = &((*pc)->next) ;
+  }
+
+  IDOCHUNK *c = malloc(sizeof(IDOCHUNK) + size) ;
+  if (!c) return NULL ;
+  c->size = size ;
+  c->used = 0 ;
+  return c ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Allocates memory from the current chunk
+// @param(in) ctx Tree context
+// @param(in) len Number of bytes required
+// @return pointer to memory or NULL on error
+//
+
+static void *_do_chunkalloc(IDOCONTEXT *ctx, unsigned long int len)
+{
+  len = _do_align(len) ;
+
+  IDOCHUNK *c = ctx->chunks ;
+
+  if (!c || c->used + len > c->size) {
+
+    if (len > ctx->chunksize/4) {
+
+      // Large requests get a chunk of their own, which is placed
+      // behind the current chunk so that it remains in use
+
+      IDOCHUNK *big = _do_getchunk(ctx, len) ;
+      if (!big) return NULL ;
+      big->used = len ;
+      if (c) {
+        big->next = c->next ;
+        c->next = big ;
+      } else {
+        big->next = NULL ;
+        ctx->chunks = big ;
+      }
+      return (char *)(big+1) ;
+
+    }
+
+    // Start a new chunk, growing geometrically
+
+    c = _do_getchunk(ctx, ctx->chunksize) ;
+    if (!c) return NULL ;
+    c->next = ctx->chunks ;
+    ctx->chunks = c ;
+
+    if (ctx->chunksize < DO_CHUNKMAX) ctx->chunksize *= 2 ;
+
+  }
+
+  void *p = (char *)(c+1) + c->used ;
+  c->used += len ;
+  return p ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the pool free list size class for an allocation
+// @param(in) len Size of allocation
+// @return size class, or -1 if too large to be pooled
+//
+
+static int _do_poolclass(unsigned long int len)
+{
+  if (len > DO_POOLMAX) return -1 ;
+  int class = 0 ;
+  unsigned long int size = DO_POOLMIN ;
+  while (size < len) { size <<= 1 ; class++ ; }
+  return class ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Allocates memory for use within a tree
+// @param(in) ctx Tree context
+// @param(in) len Number of bytes required
+// @return pointer to memory or NULL on error
+//
+
+void *_do_alloc(IDOCONTEXT *ctx, unsigned long int len)
+{
+  assert(ctx) ;
+
+  switch (ctx->mode) {
+
+  case DO_MODE_ARENA:
+
+    return _do_chunkalloc(ctx, len) ;
+
+  case DO_MODE_POOL: {
+
+    // Round up to the size class, and re-use a freed block if
+    // possible.  Large blocks come straight from the chunks, and
+    // are only reclaimed when the root is cleared.
+
+    int class = _do_poolclass(len) ;
+    if (class<0) return _do_chunkalloc(ctx, len) ;
+
+    void *p = ctx->freelist[class] ;
+    if (p) {
+      ctx->freelist[class] = *(void **)p ;
+      return p ;
+    }
+    return _do_chunkalloc(ctx, DO_POOLMIN<<class) ;
+
+  }
+
+  default:
+
+    return malloc(len) ;
+
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Resizes memory allocated with _do_alloc
+// @param(in) ctx Tree context
+// @param(in) p Existing allocation (or NULL)
+// @param(in) oldlen Size of existing allocation
+// @param(in) newlen Size required
+// @return pointer to memory or NULL on error (p remains valid)
+//
+
+void *_do_realloc(IDOCONTEXT *ctx, void *p, unsigned long int oldlen, unsigned long int newlen)
+{
+  assert(ctx) ;
+
+  if (ctx->mode==DO_MODE_HEAP) return realloc(p, newlen) ;
+
+  if (!p) return _do_alloc(ctx, newlen) ;
+
+  if (ctx->mode==DO_MODE_POOL) {
+
+    // Already big enough if the size class is unchanged
+
+    int class = _do_poolclass(oldlen) ;
+    if (class>=0 && class==_do_poolclass(newlen)) return p ;
+
+  } else {
+
+    // Grow in place if p was the last allocation in the current chunk
+
+    IDOCHUNK *c = ctx->chunks ;
+    if (c && (char *)p + _do_align(oldlen) == (char *)(c+1) + c->used &&
+        (char *)p - (char *)(c+1) + _do_align(newlen) <= c->size) {
+      c->used = (char *)p - (char *)(c+1) + _do_align(newlen) ;
+      return p ;
+    }
+
+  }
+
+  void *np = _do_alloc(ctx, newlen) ;
+  if (!np) return NULL ;
+  memcpy(np, p, oldlen<newlen ? oldlen : newlen) ;
+  _do_free(ctx, p, oldlen) ;
+  return np ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Frees memory allocated with _do_alloc
+// @param(in) ctx Tree context
+// @param(in) p Allocation to free
+// @param(in) len Size of allocation
+//
+
+void _do_free(IDOCONTEXT *ctx, void *p, unsigned long int len)
+{
+  assert(ctx) ;
+
+  if (!p) return ;
+
+  switch (ctx->mode) {
+
+  case DO_MODE_ARENA:
+
+    // Arena memory is only released when the root is cleared
+    break ;
+
+  case DO_MODE_POOL: {
+
+    int class = _do_poolclass(len) ;
+    if (class>=0) {
+      *(void **)p = ctx->freelist[class] ;
+      ctx->freelist[class] = p ;
+    }
+    break ;
+
+  }
+
+  default:
+
+    free(p) ;
+    break ;
+
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Allocates a null terminated copy of a string
+// @param(in) ctx Tree context
+// @param(in) src Source string
+// @param(in) len Length of source string
+// @return pointer to copy or NULL on error
+//
+
+char *_do_strndup(IDOCONTEXT *ctx, char *src, int len)
+{
+  char *dst = _do_alloc(ctx, len+1) ;
+  if (!dst) return NULL ;
+  memcpy(dst, src, len) ;
+  dst[len] = '\0' ;
+  return dst ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Creates a new (empty) node within a tree
+// @param(in) ctx Tree context
+// @return pointer to node, or NULL on error
+//
+
+IDATAOBJECT *_do_newnode(IDOCONTEXT *ctx)
+{
+  IDATAOBJECT *dh ;
+
+  if (ctx->mode==DO_MODE_POOL && ctx->freenodes) {
+    dh = ctx->freenodes ;
+    ctx->freenodes = dh->next ;
+  } else if (ctx->mode==DO_MODE_POOL) {
+    dh = _do_chunkalloc(ctx, sizeof(IDATAOBJECT)) ;
+  } else {
+    dh = _do_alloc(ctx, sizeof(IDATAOBJECT)) ;
+  }
+  if (!dh) return NULL ;
+
+  memset(dh, '\0', sizeof(IDATAOBJECT)) ;
+  dh->ctx = ctx ;
+  dh->type = -1 ;
+
+  return dh ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Creates a new (empty) node as the child of another,
+//        marked as the head of its chain
+// @param(in) parent Node which is to have the child (it must
+//            not have one already)
+// @return pointer to child, or NULL on error
+//
+
+IDATAOBJECT *_do_newchild(IDATAOBJECT *parent)
+{
+  assert(!parent->child) ;
+
+  IDATAOBJECT *dh = _do_newnode(parent->ctx) ;
+  if (!dh) return NULL ;
+
+  dh->flags = DO_F_HEAD ;
+  parent->child = dh ;
+
+  return dh ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Frees a node created with _do_newnode
+// @param(in) dh Node to free
+//
+
+void _do_freenode(IDATAOBJECT *dh)
+{
+  if (!dh) return ;
+
+  IDOCONTEXT *ctx = dh->ctx ;
+
+  if (ctx->mode==DO_MODE_POOL) {
+    dh->next = ctx->freenodes ;
+    ctx->freenodes = dh ;
+  } else {
+    _do_free(ctx, dh, sizeof(IDATAOBJECT)) ;
+  }
+}
+
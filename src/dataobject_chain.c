@@ -0,0 +1,484 @@
+//
+// dataobject_chain.c
+//
+// Chain index
+//
+// Finding a label amongst a chain of siblings is a linear walk,
+// which is slow for wide objects.  Once a search from the head of
+// a chain has to step past DO_CHAININDEXMIN nodes (whether or not
+// it finds the label), an index is attached to the head node.  This is an open addressing hash of
+// interned label -> first node in the chain with that label, plus
+// the chain's length and tail, so appending does not need a walk
+// either.
+//
+// The index can also hold a vector of the nodes in the chain, in
+// order, which is built when a chain (typically an array) is first
+// accessed by position, and then maintained as nodes are appended.
+//
+// Only the head of a chain can hold an index, so it is only used
+// when a search is known to start at a head.  The root of the tree
+// and every child are marked with DO_F_HEAD when they are created,
+// so this includes searches from handles returned by dochild.
+//
+// The index's tail and count make appending a new label, or using
+// '+' to reach the last entry of an array, constant time, so large
+// objects and arrays can be built through the path functions.
+//
+// Renaming a node updates its entry in the hash.  When the head
+// of the chain isn't known (a node was reached, or appended to,
+// from a handle part way along a chain), it is found from the
+// chain's tail through the tree's list of indexes.
+//
+// Clearing part of a chain can't cheaply be applied to its index,
+// so increments the tree's epoch, which makes every index stale.
+// Stale indexes are rebuilt when next needed.
+//
+
+#include <malloc.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+
+#include "dataobject_private.h"
+#include "../dataobject.h"
+
+#define DO_CHAININDEXMIN 16
+
+#define _do_labelslot(label, mask) \
+  ( (unsigned int)( ((uintptr_t)(label) >> 3) * 0x9E3779B97F4A7C15ULL >> 32 ) & (mask) )
+
+// Nodes with an integer key are hashed by its number (so that
+// "#n" finds either kind), and others by their interned label
+
+#define _do_keyslot(key, mask) \
+  ( (unsigned int)( (unsigned long int)((key)>>2) * 0x9E3779B97F4A7C15ULL >> 32 ) & (mask) )
+
+#define _do_nodeslot(node, mask) \
+  ( _do_nodekey(node)>=0 ? _do_keyslot(_do_nodekey(node), mask) : _do_labelslot((node)->label, mask) )
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Adds a node to a chain index hash, unless a node with
+//        the same label is already present
+// @param(in) c Chain index
+// @param(in) node Node to add
+//
+
+static void _do_chainhash(IDOCHAIN *c, IDATAOBJECT *node)
+{
+  unsigned int mask = c->nslots-1 ;
+  long int key = _do_nodekey(node) ;
+  unsigned int i = _do_nodeslot(node, mask) ;
+
+  while (c->slots[i]) {
+    long int slotkey = _do_nodekey(c->slots[i]) ;
+    if (key>=0 ? slotkey==key : c->slots[i]->label==node->label) {
+      c->duplicates = 1 ;
+      return ;
+    }
+
+    // An index and a field with the same number are both hashed,
+    // but "#n" matches either
+
+    if (key>=0 && slotkey>=0 && (slotkey>>2)==(key>>2)) c->duplicates = 1 ;
+
+    i = (i+1) & mask ;
+  }
+
+  c->slots[i] = node ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Removes a node from a chain index hash, moving back any
+//        following entries which would no longer be found
+// @param(in) c Chain index
+// @param(in) node Node to remove
+// @return True if the node was in the hash
+//
+
+static int _do_chainunhash(IDOCHAIN *c, IDATAOBJECT *node)
+{
+  unsigned int mask = c->nslots-1 ;
+  unsigned int i = _do_nodeslot(node, mask) ;
+
+  while (c->slots[i]!=node) {
+    if (!c->slots[i]) return 0 ;
+    i = (i+1) & mask ;
+  }
+
+  for (unsigned int j = (i+1) & mask; c->slots[j]; j = (j+1) & mask) {
+
+    // An entry can fill the gap if its own slot is not
+    // (cyclically) between the gap and where it is
+
+    unsigned int k = _do_nodeslot(c->slots[j], mask) ;
+    if (((j-k) & mask) >= ((j-i) & mask)) {
+      c->slots[i] = c->slots[j] ;
+      i = j ;
+    }
+
+  }
+
+  c->slots[i] = NULL ;
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds the head of the indexed chain containing a node
+// @param(in) node Node
+// @return Head of the chain, or NULL if the chain has no index
+//
+
+static IDATAOBJECT *_do_chainheadof(IDATAOBJECT *node)
+{
+  IDOCONTEXT *ctx = node->ctx ;
+  if (!ctx->nchains) return NULL ;
+
+  IDATAOBJECT *tail = node ;
+  while (tail->next) tail = tail->next ;
+
+  for (IDOCHAIN *c = ctx->chains; c; c = c->nextchain) {
+    if (c->epoch==ctx->epoch && c->tail==tail) return c->head ;
+  }
+
+  return NULL ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief (Re)builds the index of a chain
+// @param(in) head Head of the chain
+// @param(in) wantitems If true, the vector of nodes is built
+//            (it is always rebuilt if the index already had one)
+// @return Chain index, or NULL on error
+//
+
+static IDOCHAIN *_do_chainbuild(IDATAOBJECT *head, int wantitems)
+{
+  IDOCONTEXT *ctx = head->ctx ;
+  IDOCHAIN *c = head->chain ;
+
+  if (!c) {
+    c = _do_alloc(ctx, sizeof(IDOCHAIN)) ;
+    if (!c) return NULL ;
+    memset(c, '\0', sizeof(IDOCHAIN)) ;
+    c->head = head ;
+    c->nextchain = ctx->chains ;
+    if (ctx->chains) ctx->chains->prevchain = c ;
+    ctx->chains = c ;
+    head->chain = c ;
+    ctx->nchains++ ;
+  }
+
+  c->epoch = ctx->epoch ;
+  c->count = 0 ;
+  c->unlabelled = 0 ;
+  c->duplicates = 0 ;
+
+  // Count, and find the tail.  Unlabelled nodes can match any
+  // label, so a chain containing them is not hashed.
+
+  for (IDATAOBJECT *h = head; h; h = h->next) {
+    if (!_do_haslabel(h)) c->unlabelled = 1 ;
+    c->tail = h ;
+    c->count++ ;
+  }
+
+  // Vector of nodes
+
+  if (wantitems || c->items) {
+
+    if (c->nitems < c->count) {
+      int nitems = 16 ;
+      while (nitems < c->count) nitems *= 2 ;
+      IDATAOBJECT **items = _do_realloc(ctx, c->items, c->nitems * sizeof(IDATAOBJECT *),
+                                        nitems * sizeof(IDATAOBJECT *)) ;
+      if (!items) {
+        _do_chainfree(head) ;
+        return NULL ;
+      }
+      c->items = items ;
+      c->nitems = nitems ;
+    }
+
+    int i = 0 ;
+    for (IDATAOBJECT *h = head; h; h = h->next) c->items[i++] = h ;
+
+  }
+
+  // Hash, for long chains
+
+  if (c->unlabelled || c->count <= DO_CHAININDEXMIN) {
+    _do_free(ctx, c->slots, c->nslots * sizeof(IDATAOBJECT *)) ;
+    c->slots = NULL ;
+    c->nslots = 0 ;
+    return c ;
+  }
+
+  unsigned int nslots = 64 ;
+  while (nslots < (unsigned int)c->count*2) nslots *= 2 ;
+
+  if (nslots!=c->nslots) {
+    IDATAOBJECT **slots = _do_alloc(ctx, nslots * sizeof(IDATAOBJECT *)) ;
+    if (!slots) {
+      _do_chainfree(head) ;
+      return NULL ;
+    }
+    _do_free(ctx, c->slots, c->nslots * sizeof(IDATAOBJECT *)) ;
+    c->slots = slots ;
+    c->nslots = nslots ;
+  }
+
+  memset(c->slots, '\0', c->nslots * sizeof(IDATAOBJECT *)) ;
+  for (IDATAOBJECT *h = head; h; h = h->next) _do_chainhash(c, h) ;
+
+  return c ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the up to date index of a chain, building it
+//        if necessary
+// @param(in) head Head of the chain
+// @param(in) wantitems If true, the index must include the vector
+//            of nodes
+// @return Chain index, or NULL on error
+//
+
+IDOCHAIN *_do_chainindex(IDATAOBJECT *head, int wantitems)
+{
+  IDOCHAIN *c = head->chain ;
+
+  if (c && c->epoch==head->ctx->epoch && (c->items || !wantitems)) return c ;
+
+  return _do_chainbuild(head, wantitems) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds the first node in a chain which has the given
+//        label or key, or which has no label (and so can take any)
+// @param(in) h Node to start from
+// @param(in) label Interned label (NULL matches unlabelled nodes only)
+// @param(in) key Encoded integer key (see _do_labelkey), which is
+//            matched instead of label if not -1
+// @param(in) ishead True if h is known to be the head of the chain,
+//            so its index can be used / built
+// @param(out) tail Set to the last node in the chain when no match
+//             is found
+// @return Matching node or NULL if not found
+//
+
+IDATAOBJECT *_do_chainfind(IDATAOBJECT *h, char *label, long int key, int ishead, IDATAOBJECT **tail)
+{
+  IDOCONTEXT *ctx = h->ctx ;
+  IDOCHAIN *c = ishead ? h->chain : NULL ;
+
+  if (c && c->epoch==ctx->epoch && c->slots) {
+
+    // Indexed
+
+    unsigned int mask = c->nslots-1 ;
+
+    if (key>=0) {
+      unsigned int i = _do_keyslot(key, mask) ;
+      while (c->slots[i]) {
+        if (_do_keymatch(_do_nodekey(c->slots[i]), key)) return c->slots[i] ;
+        i = (i+1) & mask ;
+      }
+    } else if (label) {
+      unsigned int i = _do_labelslot(label, mask) ;
+      while (c->slots[i]) {
+        if (c->slots[i]->label==label) return c->slots[i] ;
+        i = (i+1) & mask ;
+      }
+    }
+
+    *tail = c->tail ;
+    return NULL ;
+
+  }
+
+  // Linear search, building the index if the chain is long (so
+  // that finding labels which are present is fast too)
+
+  IDATAOBJECT *head = h ;
+  int n = 0 ;
+
+  while (h) {
+    if (!_do_haslabel(h)) break ;
+    if (key>=0 ? _do_keymatch(_do_nodekey(h), key) : (label && h->label==label)) break ;
+    *tail = h ;
+    h = h->next ;
+    n++ ;
+  }
+
+  if (ishead && n>DO_CHAININDEXMIN && (!c || c->epoch!=ctx->epoch)) _do_chainbuild(head, 0) ;
+
+  return h ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Tests whether a chain is known not to repeat any label
+//        or key
+// @param(in) head Head of the chain
+// @return True if the chain's index shows that each label (or
+//         key) appears once, false if it may not
+//
+
+int _do_chainunique(IDATAOBJECT *head)
+{
+  IDOCHAIN *c = head->chain ;
+  return c && c->epoch==head->ctx->epoch && c->slots && !c->duplicates ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Records a node which has been linked (with its label)
+//        to the end of a chain
+// @param(in) head Head of the chain, or NULL if not known
+// @param(in) node New tail of the chain
+//
+
+void _do_chainadd(IDATAOBJECT *head, IDATAOBJECT *node)
+{
+  IDOCONTEXT *ctx = node->ctx ;
+
+  if (!head) {
+
+    // Find the index whose tail the node follows
+
+    IDOCHAIN *c = ctx->chains ;
+    while (c && (c->epoch!=ctx->epoch || c->tail->next!=node)) c = c->nextchain ;
+    if (!c) return ;
+    head = c->head ;
+
+  }
+
+  IDOCHAIN *c = head->chain ;
+  if (!c || c->epoch!=ctx->epoch) return ;
+
+  assert(c->tail->next==node) ;
+  c->tail = node ;
+  c->count++ ;
+
+  if (c->items) {
+
+    // Append to the vector, doubling it when full
+
+    if (c->count > c->nitems) {
+      IDATAOBJECT **items = _do_realloc(ctx, c->items, c->nitems * sizeof(IDATAOBJECT *),
+                                        c->nitems * 2 * sizeof(IDATAOBJECT *)) ;
+      if (!items) {
+        _do_chainfree(head) ;
+        return ;
+      }
+      c->items = items ;
+      c->nitems *= 2 ;
+    }
+    c->items[c->count-1] = node ;
+
+  }
+
+  if (!_do_haslabel(node)) {
+
+    // Unlabelled nodes can't be hashed
+
+    c->unlabelled = 1 ;
+    _do_free(ctx, c->slots, c->nslots * sizeof(IDATAOBJECT *)) ;
+    c->slots = NULL ;
+    c->nslots = 0 ;
+
+  } else if (!c->unlabelled && c->count > DO_CHAININDEXMIN &&
+             (unsigned int)c->count*2 > c->nslots) {
+
+    // Start hashing, or grow the hash (and rebuild)
+
+    _do_chainbuild(head, 0) ;
+
+  } else if (c->slots) {
+
+    _do_chainhash(c, node) ;
+
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Changes the label (or key) of a node in a chain, and
+//        updates the chain's index
+// @param(in) head Head of the chain, or NULL if not known
+// @param(in) node Node to change
+// @param(in) label New interned label (whose reference is taken
+//            over), or NULL if key is used
+// @param(in) key New integer key, or -1
+//
+
+void _do_chainrelabel(IDATAOBJECT *head, IDATAOBJECT *node, char *label, long int key)
+{
+  IDOCONTEXT *ctx = node->ctx ;
+
+  if (!head) head = _do_chainheadof(node) ;
+  IDOCHAIN *c = head ? head->chain : NULL ;
+  if (c && (c->epoch!=ctx->epoch || !c->slots)) c = NULL ;
+
+  // The hash holds the first node with each label, so when labels
+  // are repeated, removing one could leave another unfound
+
+  int rebuild = (c && (c->duplicates || !_do_chainunhash(c, node))) ;
+
+  _do_labelrelease(ctx, node->label) ;
+  node->label = label ;
+  node->flags &= ~(DO_F_KEY|DO_F_FIELD) ;
+  if (key>=0) _do_setkey(node, key) ;
+
+  if (rebuild) {
+    _do_chainbuild(head, 0) ;
+  } else if (c) {
+    _do_chainhash(c, node) ;
+
+    // The new label was already in the chain, and may be at a
+    // later node
+
+    if (c->duplicates) _do_chainbuild(head, 0) ;
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Releases the index of a chain
+// @param(in) head Head of the chain
+//
+
+void _do_chainfree(IDATAOBJECT *head)
+{
+  IDOCHAIN *c = head->chain ;
+  if (!c) return ;
+
+  IDOCONTEXT *ctx = head->ctx ;
+
+  if (c->prevchain) c->prevchain->nextchain = c->nextchain ;
+  else ctx->chains = c->nextchain ;
+  if (c->nextchain) c->nextchain->prevchain = c->prevchain ;
+
+  _do_free(ctx, c->slots, c->nslots * sizeof(IDATAOBJECT *)) ;
+  _do_free(ctx, c->items, c->nitems * sizeof(IDATAOBJECT *)) ;
+  _do_free(ctx, c, sizeof(IDOCHAIN)) ;
+  head->chain = NULL ;
+  if (ctx->nchains) ctx->nchains-- ;
+}
+
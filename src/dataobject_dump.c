@@ -41,10 +41,13 @@ void _do_dump(IDATAOBJECT *dh, int depth)
   }
 
   while (dh) {
+    char tmp[16] ;
+    int labellen ;
+    char *label = _do_labeltext(dh, tmp, &labellen) ;
     for (int i=0; i<depth; i++) printf("  ") ;
-    printf("/%s%s%s (%s):", 
+    printf("/%s%.*s%s (%s):", 
       dh->isarray?"[":"",
-      dh->label?dh->label:"<empty label>",
+      label?labellen:13, label?label:"<empty label>",
       dh->isarray?"]":"",
       (dh->type) == do_int32 ? "int32" :
       (dh->type) == do_int64 ? "int64" :
@@ -70,10 +73,11 @@ void _do_dump(IDATAOBJECT *dh, int depth)
 
       printf(" %ld", dh->d1) ;
 
-      if (dh->d2) {
+      char *d2 = _do_d2(dh) ;
+      if (d2) {
         printf(" - ") ;
         for (int i=0; i<dh->d1 && i<32; i++) {
-          if (dh->d2[i]>=' ' && dh->d2[i]<=127) printf("%c", dh->d2[i]) ;
+          if (d2[i]>=' ' && d2[i]<=127) printf("%c", d2[i]) ;
           else printf(".") ;
         }
       }
@@ -0,0 +1,149 @@
+//
+// dataobject_iter.c
+//
+// Iterators
+//
+// An iterator visits the entries of an object or array in order,
+// either just the entries themselves, or (depth first) every node
+// beneath them too.  The iterator is supplied by the caller, and
+// nothing is allocated as it steps, so a chain is traversed in
+// linear time.  When visiting depth first, the iterator holds the
+// node to resume from at each level it has descended, which limits
+// the depth to DO_ITERDEPTH levels below the start.
+//
+
+#include <string.h>
+#include <assert.h>
+
+
+#include "dataobject_private.h"
+#include "../dataobject.h"
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Starts iterating over the entries of an object / array
+// @param(out) it Iterator to initialise
+// @param(in) dh DATAOBJECT handle
+// @param(in) path Path to the object, or NULL to iterate over
+//            dh's own entries (the top level entries if dh is the
+//            root of a tree)
+// @param(in) mode DO_ITER_SIBLINGS or DO_ITER_DEPTHFIRST
+// @return True on success, false if path is not found
+//
+
+int doiter_begin(DOITER *it, IDATAOBJECT *dh, char *path, int mode)
+{
+  if (!it) return 0 ;
+
+  memset(it, '\0', sizeof(DOITER)) ;
+  it->mode = mode ;
+
+  if (!dh) return 0 ;
+
+  if (path) {
+
+    IDATAOBJECT *node = _do_search(dh, path, 0) ;
+    if (!node) return 0 ;
+    it->pending = node->child ;
+
+  } else if (dh==&(dh->ctx->root)) {
+
+    // The root is the first of the top level entries, but an
+    // empty tree has an unlabelled root
+
+    it->pending = _do_haslabel(dh) ? dh : NULL ;
+
+  } else {
+
+    it->pending = dh->child ;
+
+  }
+
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Steps to the next node
+// @param(in) it Iterator
+// @return Next node, or NULL when there are no more
+//
+
+IDATAOBJECT *doiter_next(DOITER *it)
+{
+  if (!it) return NULL ;
+
+  IDATAOBJECT *n = it->pending ;
+
+  // Having finished a level, resume from the level above
+
+  while (!n && it->depth>0) n = it->stack[--(it->depth)] ;
+
+  it->node = n ;
+  it->level = it->depth ;
+  if (!n) {
+    it->pending = NULL ;
+    return NULL ;
+  }
+
+  if (it->mode==DO_ITER_DEPTHFIRST && n->child) {
+
+    if (it->depth < DO_ITERDEPTH) {
+      it->stack[(it->depth)++] = n->next ;
+      it->pending = n->child ;
+      return n ;
+    }
+
+    // Too deep, so the children are not visited
+
+    it->truncated = 1 ;
+
+  }
+
+  it->pending = n->next ;
+  return n ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the node most recently returned by doiter_next
+// @param(in) it Iterator
+// @return Current node, or NULL
+//
+
+IDATAOBJECT *doiter_node(DOITER *it)
+{
+  return it ? it->node : NULL ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the label of the current node
+// @param(in) it Iterator
+// @param(out) len Set to length of label (if not NULL)
+// @return Label, or NULL
+//
+
+char *doiter_label(DOITER *it, int *len)
+{
+  return dolabel(it ? it->node : NULL, len) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the depth of the current node below the
+//        entries being iterated over (which are at depth 0)
+// @param(in) it Iterator
+// @return Depth
+//
+
+int doiter_depth(DOITER *it)
+{
+  return it ? it->level : 0 ;
+}
+
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "dataobject_private.h"
 #include "../dataobject.h"
@@ -28,8 +29,10 @@
 // Internal Functions
 //
 
-char * _do_asjson_start(IDATAOBJECT *dh, int *len, int isarray) ;
-int _do_fromjson_start(IDATAOBJECT *root, IDATAOBJECT *dh, char *json) ;
+int _do_asjson(IDATAOBJECT *dh, IDOTMPBUF *out) ;
+int _do_asjson_start(IDATAOBJECT *dh, IDOTMPBUF *out, int isarray) ;
+int _do_fromjson_start(IDATAOBJECT *root, IDATAOBJECT *dh, char *json, size_t len, int insitu) ;
+int _do_unescape(char *src, int srclen, char *dst) ;
 
 
 ///////////////////////////////////////////////////////////
@@ -48,12 +51,62 @@ char * doasjson(IDATAOBJECT *dh, int *len)
     return 0 ;
   }
  
-  _do_cleartmp(dh) ;
-  _do_appendtmp(dh, "{", 1) ;
-  if (dh->label) _do_asjson_start(dh, len, 0) ;
-  _do_appendtmp(dh, "}", 1) ;
+  IDOTMPBUF *out = &(dh->ctx->tmpbuf) ;
 
-  return dh->tmpbuf ;
+  _do_resettmp(out) ;
+  if (!_do_asjson(dh, out)) return NULL ;
+
+  if (len) { (*len) = out->len ; }
+  return out->buf ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Output data as a JSON string into a caller supplied buffer
+// @param[in] dh Data object handle
+// @param[out] buf Buffer to write to
+// @param[in] bufsize Size of buffer
+// @param[out] len Length of JSON data (excluding the null
+//             terminator), which is set even if it does not fit
+// @return True on success, false if the buffer is too small
+//         (len+1 bytes are required) or on error
+//
+
+int doasjson_into(IDATAOBJECT *dh, char *buf, int bufsize, int *len)
+{
+  if (!dh) {
+    fprintf(stderr, "doasjson_into: called with NULL handle\n") ;
+    return 0 ;
+  }
+
+  IDOTMPBUF out ;
+  _do_fixedtmp(&out, buf, bufsize) ;
+
+  int ok = _do_asjson(dh, &out) ;
+
+  if (len) { (*len) = out.len ; }
+  return ok && out.len < out.size ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Appends the JSON for a tree / subtree
+// @param[in] dh Data object handle
+// @param[in] out Buffer to append to
+// @return true on success
+//
+
+int _do_asjson(IDATAOBJECT *dh, IDOTMPBUF *out)
+{
+  IDOCONTEXT *ctx = dh->ctx ;
+
+  _do_appendtmp(ctx, out, "{", 1) ;
+  if (_do_haslabel(dh)) _do_asjson_start(dh, out, 0) ;
+  _do_appendtmp(ctx, out, "}", 1) ;
+
+  return !out->failed ;
 }
 
 
@@ -68,7 +121,26 @@ char * doasjson(IDATAOBJECT *dh, int *len)
 
 int dofromjson(IDATAOBJECT *dh, char *json) 
 {
-  return _do_fromjson_start(dh, dh, json) ;
+  return _do_fromjson_start(dh, dh, json, strlen(json), 0) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Import data from JSON in place.  String values are
+//        unescaped and null terminated within the json buffer,
+//        and reference it rather than being copied.
+// @param[in] dh Data object handle
+// @param[in] json JSON data, which is modified, and must outlive
+//            the tree.  It need not be null terminated.
+// @param[in] len Length of json
+// @return True on success, updates dojsonparsestrerror on failure
+//
+
+int dofromjson_insitu(IDATAOBJECT *dh, char *json, int len) 
+{
+  if (len<0) return 0 ;
+  return _do_fromjson_start(dh, dh, json, (size_t)len, 1) ;
 }
 
 
@@ -88,16 +160,19 @@ int doexpandfromjson(IDATAOBJECT *root, char *path)
   if (!node) return 0 ;
   if (node->child) return 0 ;
   if (node->type!=do_data && node->type!=do_string) return 0 ;
-  if (!node->d2) return 0 ;
-  node->child = donew() ;
-  if (!node->child) return 0 ;
-  if (!_do_fromjson_start(root, node->child, node->d2)) {
-    dodelete(node->child) ;
+  if (!_do_hasd2(node)) return 0 ;
+
+  // Borrowed data is not null terminated, so take a copy first
+
+  if ((node->flags & DO_F_BORROWED) && !_do_setdata(node, node->d2, node->d1)) return 0 ;
+
+  if (!_do_newchild(node)) return 0 ;
+  if (!_do_fromjson_start(root, node->child, _do_d2(node), strlen(_do_d2(node)), 0)) {
+    _do_clear(node->child, 1) ;
     node->child=NULL ;
     return 0 ;
   } else {
-    free(node->d2) ;
-    node->d2=NULL ;
+    _do_cleardata(node) ;
     node->d1=0 ;
     node->type=do_node ;
    return 1 ;
@@ -117,25 +192,101 @@ char * dojsonparsestrerror(IDATAOBJECT *dh)
 {
   if (!dh) {
     return "Bad Pointer" ;
-  } else if (!dh->jsonparsestatus) {
+  } else if (!dh->ctx->jsonparsestatus[0]) {
     return "OK" ;
   } else {
-    return dh->jsonparsestatus ;
+    return dh->ctx->jsonparsestatus ;
   } 
 }
 
 
 
 
+///////////////////////////////////////////////////////////
+//
+// @brief Appends string contents, escaped for JSON
+// @param(in) ctx Tree context
+// @param(in) out Output buffer
+// @param(in) s String
+// @param(in) len Length of string
+//
+// Runs of characters which need no escaping are found with
+// _do_jsoncleanlen and copied in one go.  Bytes of 0x80 and
+// above (UTF-8) are written as they are.
+//
+
+static void _do_asjsonstring(IDOCONTEXT *ctx, IDOTMPBUF *out, char *s, int len)
+{
+  static const char hex[] = "0123456789ABCDEF" ;
+  int i = 0 ;
+
+  while (i<len) {
+
+    int run = _do_jsoncleanlen(s+i, len-i) ;
+    if (run>0) {
+      _do_appendtmp( ctx, out, s+i, run ) ;
+      i += run ;
+      if (i>=len) break ;
+    }
+
+    unsigned char c = (unsigned char)s[i++] ;
+
+    switch (c) {
+      case '"':  _do_appendtmp( ctx, out, "\\\"", 2 ) ; break ;
+      case '\\': _do_appendtmp( ctx, out, "\\\\", 2 ) ; break ;
+      case '\n': _do_appendtmp( ctx, out, "\\n", 2 ) ; break ;
+      case '\r': _do_appendtmp( ctx, out, "\\r", 2 ) ; break ;
+      case '\t': _do_appendtmp( ctx, out, "\\t", 2 ) ; break ;
+      case '\b': _do_appendtmp( ctx, out, "\\b", 2 ) ; break ;
+      case '\f': _do_appendtmp( ctx, out, "\\f", 2 ) ; break ;
+      default: {
+        char escaped[6] = { '\\', 'u', '0', '0', hex[c>>4], hex[c&0x0F] } ;
+        _do_appendtmp( ctx, out, escaped, 6 ) ;
+        break ;
+      }
+    }
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Appends a number
+// @param(in) ctx Tree context
+// @param(in) out Output buffer
+// @param(in) type Type of number
+// @param(in) d1 Encoded value
+//
+// The number is written straight into the buffer, unless it is a
+// fixed buffer without room.
+//
+
+static void _do_asjsonnumber(IDOCONTEXT *ctx, IDOTMPBUF *out, int type, unsigned long int d1)
+{
+  if (_do_reservetmp(ctx, out, DO_NUMBERMAX)) {
+    out->len += _do_formatnumber( &(out->buf[out->len]), type, d1 ) ;
+    out->buf[out->len] = '\0' ;
+  } else {
+    char num[DO_NUMBERMAX] ;
+    _do_appendtmp( ctx, out, num, _do_formatnumber(num, type, d1) ) ;
+  }
+}
+
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
 // Internal _do_asjson function
 //
+// Children are written straight into the same output buffer
+// as their parents, so the whole tree is produced in a single
+// traversal without copying.
+//
 
-char * _do_asjson_start(IDATAOBJECT *dh, int *len, int isarray)
+int _do_asjson_start(IDATAOBJECT *dh, IDOTMPBUF *out, int isarray)
 {
 
+  IDOCONTEXT *ctx = dh->ctx ;
   IDATAOBJECT *h = dh ;
 
   while (h) {
@@ -143,54 +294,38 @@ char * _do_asjson_start(IDATAOBJECT *dh, int *len, int isarray)
     // Append label
 
     if (!(isarray)) {
-      _do_appendtmp( dh, "\"", 1 ) ;
-      if (h->label) _do_appendtmp( dh, h->label, strlen(h->label) ) ;
-      _do_appendtmp( dh, "\":", 2 ) ;
+      char tmp[16] ;
+      int labellen ;
+      char *label = _do_labeltext(h, tmp, &labellen) ;
+      _do_appendtmp( ctx, out, "\"", 1 ) ;
+      if (label) _do_appendtmp( ctx, out, label, labellen ) ;
+      _do_appendtmp( ctx, out, "\":", 2 ) ;
     }
 
     if (h->type==do_node && !h->isarray) {
 
       // Recurse / append {child}
 
-      _do_appendtmp( dh, "{", 1 ) ;
+      _do_appendtmp( ctx, out, "{", 1 ) ;
 
-      if (h->child) {
-        int len ;
-        _do_cleartmp(h->child) ;
-        char *sub = _do_asjson_start(h->child, &len, 0) ;
-        if (len>=0) { 
-          _do_appendtmp( dh, sub, len ) ; 
-        }
-        _do_cleartmp(h->child) ;
-      }
+      if (h->child) _do_asjson_start(h->child, out, 0) ;
 
-      _do_appendtmp( dh, "}", 1 ) ;
-      _do_cleartmp(h->child) ;
+      _do_appendtmp( ctx, out, "}", 1 ) ;
 
     } else if (h->type==do_node && h->isarray) {
 
       // Recurse / append [child]
 
-      _do_appendtmp( dh, "[", 1 ) ;
+      _do_appendtmp( ctx, out, "[", 1 ) ;
 
-      if (h->child) {
-        int len ;
-        _do_cleartmp(h->child) ;
-        char *sub = _do_asjson_start(h->child, &len, 1) ;
-        if (len>=0) { 
-          _do_appendtmp( dh, sub, len ) ; 
-        }
-        _do_cleartmp(h->child) ;
-      }
+      if (h->child) _do_asjson_start(h->child, out, 1) ;
 
-      _do_appendtmp( dh, "]", 1 ) ;
+      _do_appendtmp( ctx, out, "]", 1 ) ;
 
     } else {
 
       // Append data
 
-      char num[32] ;
-
       switch (h->type) {
 
         case do_64bit:
@@ -202,61 +337,28 @@ char * _do_asjson_start(IDATAOBJECT *dh, int *len, int isarray)
         case do_fixed32:
         case do_int32: 
         case do_int64:
-
-          sprintf(num, "%lu", h->d1) ;
-          _do_appendtmp( dh, num, strlen(num) ) ;
-          break ;
-
         case do_sint32:
         case do_sfixed32:
         case do_sint64:
         case do_sfixed64:
+        case do_float:
+        case do_double:
 
-          sprintf(num, "%ld", _do_signeddecode(h->d1)) ;
-          _do_appendtmp( dh, num, strlen(num) ) ;
+          _do_asjsonnumber( ctx, out, h->type, h->d1 ) ;
           break ;
 
         case do_string:
         case do_data:    
 
-          if (!h->d2) {
+          if (!_do_hasd2(h)) {
 
-            _do_appendtmp(dh, "null",4) ;
+            _do_appendtmp( ctx, out, "null",4) ;
 
           } else {
 
-            _do_appendtmp( dh, "\"", 1 ) ;
-
-            for (int i=0; i<h->d1; i++) {
-
-              if (h->d2[i]=='\"') {
-                _do_appendtmp( dh, "\\\"", 2) ;
-
-              } else if (h->d2[i]=='\\') {
-                _do_appendtmp( dh, "\\\\", 2) ;
-
-              } else if (h->d2[i]=='\n') {
-                _do_appendtmp( dh, "\\n", 2) ;
-
-              } else if (h->d2[i]=='\r') {
-                _do_appendtmp( dh, "\\r", 2) ;
-
-              } else if (h->d2[i]=='\t') {
-                _do_appendtmp( dh, "\\t", 2) ;
-
-              } else if (h->d2[i]=='\'') {
-                _do_appendtmp( dh, "\\u0027", 2) ;
-
-              } else if (h->d2[i]<32) {
-                char escaped[32] ;
-                snprintf(escaped, sizeof(escaped)-1, "\\u%04X", h->d2[i]) ;
-                _do_appendtmp( dh, "\\u", 2) ;
-
-              } else {
-              _do_appendtmp( dh, &(h->d2[i]), 1) ;
-              }
-            }
-            _do_appendtmp( dh, "\"", 1 ) ;
+            _do_appendtmp( ctx, out, "\"", 1 ) ;
+            _do_asjsonstring( ctx, out, _do_d2(h), h->d1 ) ;
+            _do_appendtmp( ctx, out, "\"", 1 ) ;
 
           }
 
@@ -264,20 +366,8 @@ char * _do_asjson_start(IDATAOBJECT *dh, int *len, int isarray)
 
         case do_bool:
 
-          if (h->d1) _do_appendtmp( dh, "true", 4 ) ;
-          else _do_appendtmp( dh, "false", 5 ) ;
-          break ;
-
-        case do_float:
-
-          sprintf(num, "%f", _do_floatdecode(h->d1)) ;
-          _do_appendtmp( dh, num, strlen(num) ) ;
-          break ;
-
-        case do_double:
-
-          sprintf(num, "%f", _do_doubledecode(h->d1)) ;
-          _do_appendtmp( dh, num, strlen(num) ) ;
+          if (h->d1) _do_appendtmp( ctx, out, "true", 4 ) ;
+          else _do_appendtmp( ctx, out, "false", 5 ) ;
           break ;
 
       }
@@ -286,14 +376,11 @@ char * _do_asjson_start(IDATAOBJECT *dh, int *len, int isarray)
     // Move to next entry in chain
 
     h = h->next ;
-    if (h) _do_appendtmp( dh, ",", 1 ) ;
+    if (h) _do_appendtmp( ctx, out, ",", 1 ) ;
 
   }
 
-  // Return 
-
-  if (len) { (*len) = dh->tmpbuflen ; } 
-  return dh->tmpbuf ;
+  return !out->failed ;
 
 }
 
@@ -305,75 +392,106 @@ char * _do_asjson_start(IDATAOBJECT *dh, int *len, int isarray)
 // Internal _do_fromjson_start functions
 //
 
-int _do_jsonfieldlen(char *str)
-{
-  int instring ;
-  int escape=0 ;
-  int len=0 ;
-  
-  if (*str=='\"') {
-    instring=1 ;
-    len++ ;
-  } else {
-    instring=0 ;
-  }
-
-  int done=0 ;
-
-  do {
-
-    if (str[len]=='\0') {
-
-      done=1 ;
-
-    } else if (!escape && instring && str[len]=='\"') {
-
-      // Finish string
-
-      len++ ;
-      done=1 ;
-
-    } else if (instring) {
-
-      // Skip through string
-
-      len++ ;
-
-    } else if ( !escape && !instring && 
-                ( isalnum(str[len]) || str[len]=='.' || 
-                  str[len]=='+' || str[len]=='-' ) ) {
-
-      // Step through text or number
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the character at an index entry, or '\0' for the
+//        terminator, which is at the end of the document rather
+//        than on a character within it
+// @param(in) ctx Tree context (holding the document length)
+// @param(in) json JSON text
+// @param(in) ix Structural index
+// @param(in) k Index entry
+// @return Character
+//
 
-      len++ ;
+static inline char _do_jsonchar(IDOCONTEXT *ctx, char *json, unsigned int *ix, int k)
+{
+  return ((int)ix[k] < ctx->jsonlen) ? json[ix[k]] : '\0' ;
+}
 
-    } else if (escape) {
 
-      // Skip escaped character
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of the string or value at an index
+//        entry, which ends at the last non whitespace character
+//        before the next entry
+// @param(in) json JSON text
+// @param(in) ix Structural index
+// @param(in) k Index entry (which is not the terminator)
+// @return Length, including quotes
+//
 
-      len++ ;
+static int _do_jsontokenlen(char *json, unsigned int *ix, int k)
+{
+  int start = ix[k] ;
+  int end = ix[k+1] ;
+  while (end>start+1 && isspace(json[end-1])) end-- ;
+  return end-start ;
+}
 
-    } else {
 
-      // Anthing else is the end!
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of the string at an index entry
+// @param(in) json JSON text
+// @param(in) ix Structural index
+// @param(in) k Index entry of the opening quote
+// @return Length, including quotes, or -1 if it is not terminated
+//
 
-      done=1 ;
+static int _do_jsonstringlen(char *json, unsigned int *ix, int k)
+{
+  int len = _do_jsontokenlen(json, ix, k) ;
+  if (len<2 || json[ix[k]+len-1]!='\"') return -1 ;
+  return len ;
+}
 
-    }
 
-    escape = (str[len]=='\\') ;
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of the number or literal (true,
+//        false, null) at an index entry
+// @param(in) json JSON text
+// @param(in) ix Structural index
+// @param(in) k Index entry
+// @return Length, or -1 if it is not a number or literal
+//
 
+static int _do_jsonvaluelen(char *json, unsigned int *ix, int k)
+{
+  char *p = &(json[ix[k]]) ;
+  if (!isalnum(*p) && *p!='.' && *p!='+' && *p!='-') return -1 ;
 
-  } while ( !done ) ;
+  int len = _do_jsontokenlen(json, ix, k) ;
+  for (int i=1; i<len; i++) {
+    if (!isalnum(p[i]) && p[i]!='.' && p[i]!='+' && p[i]!='-') return -1 ;
+  }
 
   return len ;
 }
 
 
-int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int *pos, int depth, int isarray) 
+///////////////////////////////////////////////////////////
+//
+// @brief Builds the entries of an object or array from the
+//        structural index
+// @param(in) rootroot Node which holds the parse status
+// @param(in) entryroot Node to hold the first entry
+// @param(in) json JSON text
+// @param(in) ix Structural index of json
+// @param(in/out) k Index entry to start from, updated to the
+//                closing ] or }, or set to -1 on error
+// @param(in) depth Nesting depth
+// @param(in) isarray True if parsing an array
+// @param(in) insitu True if string values reference json
+// @return True on success
+//
+
+int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, unsigned int *ix, int *k, int depth, int isarray, int insitu) 
 {
   enum { PARSEOK, BADCHAR, NOLABEL, ERRMALLOC, 
-         ARRAYENDEXPECTED, OBJECTENDEXPECTED, ERRORCHILD} parseerror = PARSEOK ;
+         ARRAYENDEXPECTED, OBJECTENDEXPECTED, STRINGENDEXPECTED,
+         TOODEEP, ERRORCHILD} parseerror = PARSEOK ;
 
   IDATAOBJECT *entry = NULL ;
   int commadetected ;
@@ -381,16 +499,17 @@ int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int
 
   // maintain depth counter
 
-  if (depth>10) goto fail ;
+  if (depth>10) {
+    parseerror = TOODEEP ;
+    goto fail ;
+  }
 
   // Loop
 
   do {
 
-    // skip spaces
-
-    while (isspace(json[*pos])) (*pos)++ ;
-    if (json[*pos]=='\0' || json[*pos]=='}' || json[*pos]==']') break ;
+    char ch = _do_jsonchar(rootroot->ctx, json, ix, *k) ;
+    if (ch=='\0' || ch=='}' || ch==']') break ;
 
     // if first node, use the passed object, otherwise
     // create new node, and set to root or next
@@ -398,11 +517,11 @@ int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int
     if (entry==NULL) {
 
       entry = entryroot ;
-      _do_clear(entry, 0, 1) ;
+      _do_clear(entry, 0) ;
 
     } else {
 
-      IDATAOBJECT *newentry = donew() ;
+      IDATAOBJECT *newentry = _do_newnode(entry->ctx) ;
       if (!newentry) {
         parseerror = ERRMALLOC ;
         goto fail ;
@@ -414,31 +533,27 @@ int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int
 
     if (isarray) {
 
-      // if isarray create label as an array
+      // if isarray, entries are keyed by their index (and
+      // labelled "0", "1" ... when needed)
 
-      char counter[16] ;
-      sprintf(counter, "%d", count++) ;
-      entry->label = malloc(strlen(counter)+1) ;
-      if (!entry->label) {
-        parseerror = ERRMALLOC ;
-        goto fail ;
-      }
-      strcpy(entry->label, counter) ;
+      _do_setkey(entry, (long int)(count++)<<2 | DO_KEY_INDEX) ;
       entry->type = do_node ;
 
-    } else if (json[*pos]=='\"') {
+    } else if (ch=='\"') {
 
       // if !isarray fetch label from json
 
-      int labellen = _do_jsonfieldlen(&(json[*pos])) ;
-      entry->label = malloc(labellen-1) ;
-      if (!entry->label) {
+      int labellen = _do_jsonstringlen(json, ix, *k) ;
+      if (labellen<0) {
+        parseerror = STRINGENDEXPECTED ;
+        goto fail ;
+      }
+      char *label = &(json[ix[*k]+1]) ;
+      if (!_do_labelnode(entry, label, labellen-2, _do_labelkey(label, labellen-2, 0))) {
         parseerror = ERRMALLOC ;
         goto fail ;
       }
-      strncpy(entry->label, &(json[(*pos)+1]), labellen-2) ;
-      entry->label[labellen-2]='\0' ;
-      (*pos)+=labellen ;
+      (*k)++ ;
       entry->type = do_node ;
       entry->isarray = isarray ;
 
@@ -449,44 +564,47 @@ int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int
 
     }
 
-    // skip white spaces or colons
+    // skip colons
 
-    while (isspace(json[*pos]) || json[*pos]==':') (*pos)++ ;
+    while (_do_jsonchar(rootroot->ctx, json, ix, *k)==':') (*k)++ ;
 
 
     // Check character
 
-    char ch = json[*pos] ;
+    ch = _do_jsonchar(rootroot->ctx, json, ix, *k) ;
 
     //  if { recurse and store results in child
     //  if [ recurse array and store results in child
 
     if (ch=='{' || ch=='[') {
 
-      (*pos)++ ;
+      (*k)++ ;
 
 // TODO: change so that entry->isarray goes, and do_nodearray used
 
       entry->type = do_node ;
-      entry->child = donew() ;
+      if (!_do_newchild(entry)) {
+        parseerror = ERRMALLOC ;
+        goto fail ;
+      }
       entry->isarray = (ch=='[') ;
 
-      _do_fromjson(rootroot, entry->child, json, pos, depth+1, entry->isarray) ;
+      _do_fromjson(rootroot, entry->child, json, ix, k, depth+1, entry->isarray, insitu) ;
 
-      if (!entry->child->label) {
+      if (!_do_haslabel(entry->child)) {
         // No data was filled in to child
-        dodelete(entry->child) ;
+        _do_clear(entry->child, 1) ;
         entry->child=NULL ;
       }
 
-      if ((*pos)<0) {
+      if ((*k)<0) {
         // Error message should have been set in child
         // e.g. missing ] or } termination
         parseerror = ERRORCHILD ;
         goto fail ;
       }
 
-      (*pos)++ ;
+      (*k)++ ;
 
     }
 
@@ -495,31 +613,59 @@ int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int
 
     else {
 
-        int datalen = _do_jsonfieldlen(&(json[*pos])) ;
+        int p = ix[*k] ;
+        int datalen = (ch=='\"') ? _do_jsonstringlen(json, ix, *k) :
+                      (ch!='\0') ? _do_jsonvaluelen(json, ix, *k) : -1 ;
 
-        if (json[*pos]=='\"') {
+        if (ch=='\"') {
 
           // "string" -> store string\0 and length=6
 
-// TODO: parse escaped characters and \u unicode sequences
-// Need a de-escape function which has 2 passes (the first just calculates
-// the length, and the second actually places the data
-
-          entry->d1 = 0 ;
-          entry->d2 = malloc(datalen-1) ; // string\0
-          entry->type = do_data ;
-          if (!entry->d2) {
-            parseerror = ERRMALLOC ;
+          if (datalen<0) {
+            parseerror = STRINGENDEXPECTED ;
             goto fail ;
           }
-          entry->d1 = (datalen-2) ;  // string without quotes
-          if (datalen>2) {
-            // Copy data for non-empty strings
-            strncpy(entry->d2, &(json[(*pos)+1]), datalen-2) ;
+
+          char *str = &(json[p+1]) ;
+          int len = datalen-2 ;
+          entry->type = do_data ;
+
+          if (insitu) {
+
+            // Unescape in place, and null terminate over the
+            // closing quote (or the space freed by unescaping)
+
+            len = _do_unescape(str, len, str) ;
+            str[len] = '\0' ;
+            _do_cleardata(entry) ;
+            entry->d2 = str ;
+            entry->d1 = len ;
+            entry->flags |= DO_F_BORROWED ;
+
+          } else {
+
+            // Copy and unescape straight into the node, then give
+            // back any space freed by unescaping
+
+            char *d2 = _do_allocdata(entry, len) ;
+            if (!d2) {
+              parseerror = ERRMALLOC ;
+              goto fail ;
+            }
+            int dlen = _do_unescape(str, len, d2) ;
+            if (dlen<len && !_do_truncdata(entry, dlen)) {
+              parseerror = ERRMALLOC ;
+              goto fail ;
+            }
+
           }
-          entry->d2[datalen-2]='\0' ;
 
-        } else if (json[*pos]=='n' || json[*pos]=='N') {
+        } else if (datalen<0) {
+
+          parseerror=BADCHAR ;
+          goto fail ;
+
+        } else if (ch=='n' || ch=='N') {
 
           // null string
           // entry->d1 remains as 0 ;
@@ -527,48 +673,28 @@ int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int
           entry->type = do_string ;
 
 
-        } else if (json[*pos]=='t' || json[*pos]=='T') {
+        } else if (ch=='t' || ch=='T') {
 
           // boolean
           entry->d1 = 1 ;
           entry->type = do_bool ;
 
-        } else if (json[*pos]=='f' || json[*pos]=='F') {
+        } else if (ch=='f' || ch=='F') {
 
           // boolean
           entry->d1 = 0 ;
           entry->type = do_bool ;
 
-        } else if (isdigit(json[*pos]) || json[*pos]=='+' || json[*pos]=='-' || json[*pos]=='.') {
-
-          // number
+        } else if (isdigit(ch) || ch=='+' || ch=='-' || ch=='.') {
 
-          int isfloat=0 ;
-
-          int l=0 ;
-          while (isdigit(json[(*pos)+l]) || json[(*pos)+l]=='+' || json[(*pos)+l]=='-' || json[(*pos)+l]=='.') { 
-            isfloat |= json[(*pos)+l]=='.' ;
-            l++ ; 
-          }
-
-          if (isfloat) {
-
-            // float 
-
-            double d ;
-            sscanf(&json[(*pos)], "%lf", &d) ;
-            entry->d1 = _do_doubleencode(d) ;
-            entry->type = do_double ;
-
-          } else {
-
-            // Signed int
-
-            signed long int j = atoi(&json[*pos]) ;
-            entry->d1 = _do_signedencode(j) ;
-            entry->type = do_sint64 ;
+          // number, which must be the whole value
 
+          int type ;
+          if (_do_parsenumber(&json[p], datalen, &type, &(entry->d1))!=datalen) {
+            parseerror=BADCHAR ;
+            goto fail ;
           }
+          entry->type = type ;
 
         } else {
 
@@ -577,26 +703,26 @@ int _do_fromjson(IDATAOBJECT *rootroot, IDATAOBJECT *entryroot, char *json, int
 
         }
 
-        (*pos)+=datalen ;
+        (*k)++ ;
 
     }
 
-    // Skip to end of record ( treat ,, ,\n, as , )
+    // Skip to end of record ( treat ,, as , )
 
     commadetected=0 ;
-    while (isspace(json[*pos]) || json[*pos]==',') {
-      if (json[*pos]==',') commadetected=1 ;
-      (*pos)++ ;
+    while (_do_jsonchar(rootroot->ctx, json, ix, *k)==',') {
+      commadetected=1 ;
+      (*k)++ ;
     }
 
   } while (commadetected) ;
 
-  if (isarray && json[(*pos)]!=']') {
+  if (isarray && _do_jsonchar(rootroot->ctx, json, ix, *k)!=']') {
     parseerror=ARRAYENDEXPECTED ;
     goto fail ;
   }
 
-  if (!isarray && json[(*pos)]!='}') {
+  if (!isarray && _do_jsonchar(rootroot->ctx, json, ix, *k)!='}') {
     parseerror=OBJECTENDEXPECTED ;
     goto fail ;
   }
@@ -607,8 +733,7 @@ fail:
 
     // Clear error message
 
-    if (rootroot->jsonparsestatus) free(rootroot->jsonparsestatus) ;
-    rootroot->jsonparsestatus=NULL ;
+    rootroot->ctx->jsonparsestatus[0]='\0' ;
     return 1 ;
 
   } else if (parseerror==ERRORCHILD) {
@@ -619,31 +744,32 @@ fail:
 
   } else {
 
+    // Clear the partial tree before setting the error message
+    // (clearing the root of an arena tree releases its memory)
+
+    _do_clear(entryroot, 0) ;
+
     // Set parse error message
 
     char errormessage[256] ;
 
-    if (rootroot->jsonparsestatus) free(rootroot->jsonparsestatus) ;
-    rootroot->jsonparsestatus=NULL ;
-
     snprintf(errormessage, sizeof(errormessage)-11, 
            "%s at character %d, found : ",
            (parseerror==NOLABEL) ? "Missing Label" :
            (parseerror==BADCHAR) ? "Unexpected Character" :
            (parseerror==ARRAYENDEXPECTED) ? "Expected ]" :
            (parseerror==OBJECTENDEXPECTED) ? "Expected }" :
+           (parseerror==STRINGENDEXPECTED) ? "Expected \"" :
+           (parseerror==TOODEEP) ? "Too deeply nested" :
            (parseerror==ERRMALLOC) ? "Out of Memory" : "?",
-           (*pos)) ;
+           ix[*k]) ;
 
-    strncat(errormessage, &json[(*pos)], 10);
-    rootroot->jsonparsestatus = malloc(strlen(errormessage)+1) ;
+    int found = rootroot->ctx->jsonlen - (int)ix[*k] ;
+    strncat(errormessage, &json[ix[*k]], (found<10) ? found : 10);
     strcat(errormessage, "...") ;
-    if (rootroot->jsonparsestatus) {
-      strcpy(rootroot->jsonparsestatus, errormessage) ;
-    }
+    strcpy(rootroot->ctx->jsonparsestatus, errormessage) ;
 
-    (*pos)=-1 ;
-    _do_clear(entryroot, 0, (entryroot!=rootroot)) ;
+    (*k)=-1 ;
 
     return 0 ;
 
@@ -652,38 +778,74 @@ fail:
 }
 
 
-int _do_fromjson_start(IDATAOBJECT *root, IDATAOBJECT *dh, char *json) 
+int _do_fromjson_start(IDATAOBJECT *root, IDATAOBJECT *dh, char *json, size_t len, int insitu) 
 {
   if (!dh) return 0 ;
 
-  int len=0 ;
+  int k=0 ;
 
-  while (isspace(*json)) json++ ;
-  char ch = (*json) ;
+  while (len>0 && isspace(*json)) { json++ ; len-- ; }
+  char ch = (len>0) ? (*json) : '\0' ;
   if (ch=='{' || ch=='[') {
+
     json++ ;
-    _do_fromjson(root, dh, json, &len, 0, (ch=='[') ) ;
+    len-- ;
+
+    // Find the structure first (positions are within the index,
+    // so documents are limited to 2GB)
+
+    if (len >= INT_MAX) {
+      strcpy(root->ctx->jsonparsestatus, "Document too large") ;
+      return 0 ;
+    }
+    if (!_do_jsonindex(root->ctx, json, (int)len)) {
+      strcpy(root->ctx->jsonparsestatus, "Out of Memory") ;
+      return 0 ;
+    }
+    root->ctx->jsonlen = (int)len ;
+
+    _do_fromjson(root, dh, json, root->ctx->jsonindex, &k, 0, (ch=='['), insitu ) ;
+
+    // Don't hold on to a large document's index for the life
+    // of the tree, unless the tree is pooled, where the next
+    // parse is expected to be as large and must not reallocate
+
+    if (root->ctx->mode!=DO_MODE_POOL && root->ctx->maxjsonindex > DO_JSONINDEXKEEP) {
+      unsigned int *index = realloc(root->ctx->jsonindex, DO_JSONINDEXKEEP * sizeof(unsigned int)) ;
+      if (index) {
+        root->ctx->jsonindex = index ;
+        root->ctx->maxjsonindex = DO_JSONINDEXKEEP ;
+      } else {
+        free(root->ctx->jsonindex) ;
+        root->ctx->jsonindex = NULL ;
+        root->ctx->maxjsonindex = 0 ;
+      }
+    }
+
   }
 
-  return (len>=0) ;
+  return (k>=0) ;
 
 }
 
 
 
 
-// This function is currently unused
-
-// 
-// @brief Removes JSON escape sequences
+///////////////////////////////////////////////////////////
+//
+// @brief Removes JSON escape sequences.  The output is never longer
+//        than the input, so src and dst may be the same buffer.
+//        Runs without escapes are found with memchr (which is
+//        vectorised) and copied in one go, so a string with few
+//        escapes is copied at close to memcpy speed.
 // @param(in) src - Source data string (does not stop at \0)
 // @param(in) srclen - Length of Source string
-// @param(out) dst - if not NULL, pointer to store location
-// @param(in) maxdst - Max length of dst
-// @return Number of bytes that are / would be placed in dst
+// @param(out) dst - Pointer to store location, with room for
+//             srclen bytes
+// @return Number of bytes placed in dst
 //
 
-// RFC 7159
+// RFC 8259
 // char = unescaped /
 //        escape (
 //            %x22 /          ; "    quotation mark  U+0022
@@ -696,90 +858,131 @@ int _do_fromjson_start(IDATAOBJECT *root, IDATAOBJECT *dh, char *json)
 //            %x74 /          ; t    tab             U+0009
 //            %x75 4HEXDIG )  ; uXXXX                U+XXXX
 //
+// \uXXXX sequences are written as UTF-8, with UTF-16 surrogate
+// pairs combined.  A surrogate which is not part of a pair is
+// written as U+FFFD.  Unrecognised escape sequences are copied
+// unchanged.
 
-// TODO: This is very crude, and doesn't handle UTF16 character
-// sequences.
+static int _do_hexval(char h)
+{
+  if (h>='0' && h<='9') return h-'0' ;
+  if (h>='a' && h<='f') return h-'a'+10 ;
+  if (h>='A' && h<='F') return h-'A'+10 ;
+  return -1 ;
+}
 
-#define htoi(h) (h>='0' && h<='9')?(h-'0'):(tolower(h)-'a'+10)
+static int _do_hex4(char *src)
+{
+  int cp=0 ;
+  for (int k=0; k<4; k++) {
+    int v = _do_hexval(src[k]) ;
+    if (v<0) return -1 ;
+    cp = (cp<<4) | v ;
+  }
+  return cp ;
+}
 
-int _do_unescape(char *src, int srclen, char *dst, int maxdst)
+static int _do_utf8(unsigned int cp, char *dst)
+{
+  if (cp<0x80) {
+    dst[0]=cp ;
+    return 1 ;
+  } else if (cp<0x800) {
+    dst[0]=0xC0|(cp>>6) ; dst[1]=0x80|(cp&0x3F) ;
+    return 2 ;
+  } else if (cp<0x10000) {
+    dst[0]=0xE0|(cp>>12) ; dst[1]=0x80|((cp>>6)&0x3F) ; dst[2]=0x80|(cp&0x3F) ;
+    return 3 ;
+  } else {
+    dst[0]=0xF0|(cp>>18) ; dst[1]=0x80|((cp>>12)&0x3F) ; dst[2]=0x80|((cp>>6)&0x3F) ; dst[3]=0x80|(cp&0x3F) ;
+    return 4 ;
+  }
+}
+
+int _do_unescape(char *src, int srclen, char *dst)
 {
   int i=0, j=0 ;
 
   while (i<srclen) {
 
-    if (src[i]!='\\' || i==(srclen-1)) {
+    // Copy up to the next escape
+
+    char *bs = memchr(&src[i], '\\', srclen-i) ;
+    int run = bs ? (int)(bs-&src[i]) : srclen-i ;
+    if (run) {
+      if (dst+j!=src+i) memmove(&dst[j], &src[i], run) ;
+      i+=run ; j+=run ;
+    }
+    if (i>=srclen-1) {
+      if (i<srclen) dst[j++] = src[i++] ;
+      break ;
+    }
 
-      if (dst) { dst[j] = src[i] ; }
-      i++ ; j++ ;
+    char ch ;
 
-    } else {
+    switch (src[i+1]) {
 
-      switch (src[++i]) {
+      case '\"':  ch = '\"' ; break ;
+      case '\\': ch = '\\' ; break ;
+      case '/':  ch = '/' ; break ;
+      case 'b':  ch = '\b' ; break ;
+      case 'f':  ch = '\f' ; break ;
+      case 'n':  ch = '\n' ; break ;
+      case 'r':  ch = '\r' ; break ;
+      case 't':  ch = '\t' ; break ;
 
-        case '\\':
+      case 'u': {
 
-          if (dst) { dst[j] = src[i] ; }
-          i++ ; j++ ;
+        int cp = (i+6<=srclen) ? _do_hex4(&src[i+2]) : -1 ;
+        if (cp<0) {
+          ch = 0 ;
           break ;
+        }
+        i+=6 ;
 
-        case '/':
+        if (cp>=0xD800 && cp<=0xDBFF) {
 
-          if (dst) { dst[j] = '/' ; }
-          i++ ; j++ ;
-          break ;
+          // High surrogate, which needs a low surrogate to follow
+
+          int lo = (i+6<=srclen && src[i]=='\\' && src[i+1]=='u') ? _do_hex4(&src[i+2]) : -1 ;
+          if (lo>=0xDC00 && lo<=0xDFFF) {
+            cp = 0x10000 + ((cp-0xD800)<<10) + (lo-0xDC00) ;
+            i+=6 ;
+          } else {
+            cp = 0xFFFD ;
+          }
 
-        case 'f':
+        } else if (cp>=0xDC00 && cp<=0xDFFF) {
 
-          if (dst) { dst[j] = '\f' ; }
-          i++ ; j++ ;
-          break ;
+          cp = 0xFFFD ;
 
-        case 'n':
+        }
 
-          if (dst) { dst[j] = '\n' ; }
-          i++ ; j++ ;
-          break ;
+        j += _do_utf8(cp, &dst[j]) ;
+        continue ;
 
-        case 'r':
+      }
 
-          if (dst) { dst[j] = '\r' ; }
-          i++ ; j++ ;
-          break ;
+      default:   ch = 0 ; break ;
+
+    }
 
-        case 't':
+    if (ch) {
 
-          if (dst) { dst[j] = '\t' ; }
-          i++ ; j++ ;
-          break ;
+      dst[j++] = ch ;
+      i+=2 ;
 
-        case 'u':
+    } else {
 
-          if (i<=(srclen-4)) {
-            int ch ;
-            ch = htoi(src[i]) * 0x1000 +
-                 htoi(src[i+1]) * 0x0100 +
-                 htoi(src[i+2]) * 0x0010 +
-                 htoi(src[i+3]) ;
-            if (dst) { dst[j] = ch ; }
-            i+=4 ; j++ ;
-            break ;
+      // Not recognised, copy as is
 
-        default:
+      dst[j] = '\\' ;
+      dst[j+1] = src[i+1] ;
+      i+=2 ; j+=2 ;
 
-            if (dst) {
-              dst[j]='\\' ;
-              dst[j+1]=src[i] ;
-            }
-            i++ ; j+=2 ;
-            break ;
-        }
-      }      
     }
   }
 
   return j ;
 
 }
-
-
@@ -0,0 +1,501 @@
+//
+// dataobject_jsonscan.c
+//
+// JSON structural index
+//
+// Before a JSON document is parsed, it is scanned 64 bytes at a
+// time to find its structure.  Each block is classified into
+// bitmasks of quotes, backslashes, structural characters and
+// whitespace, using AVX2 or SSE2 compares where available (chosen
+// once, on first use), or otherwise 8 bytes at a time in a 64 bit
+// word.  Escaped quotes are
+// removed from the quote mask, and a prefix XOR of what is left
+// marks the bytes which are inside strings.
+//
+// The index is then the offset of every structural character
+// ({}[]:,) outside a string, of the opening quote of every string,
+// and of the first character of every other value (number, true,
+// false, null), followed by the length of the document as a
+// terminator (the document need not be null terminated).
+//
+// The parser walks the index rather than the text, so it never
+// steps through string contents or whitespace: a string or value
+// ends at the last non whitespace character before the next entry.
+//
+// Strings being written out as JSON are scanned for characters
+// which need escaping in the same way (see below).
+//
+// Building with DO_NOSIMD selects the portable versions only.
+//
+
+#include <malloc.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && !defined(DO_NOSIMD)
+#define DO_JSONSIMD
+#include <immintrin.h>
+#endif
+
+
+#include "dataobject_private.h"
+#include "../dataobject.h"
+
+#define DO_JSONBLOCK 64
+
+#define DO_JSON_QUOTE 0x01
+#define DO_JSON_BACKSLASH 0x02
+#define DO_JSON_OP 0x04
+#define DO_JSON_SPACE 0x08
+
+#define DO_EVENBITS 0x5555555555555555ULL
+
+
+typedef struct IDOJSONMASKS {
+  uint64_t quote ;
+  uint64_t backslash ;
+  uint64_t op ;
+  uint64_t space ;
+} IDOJSONMASKS ;
+
+typedef void (*_do_jsonclassifier)(const unsigned char *, IDOJSONMASKS *) ;
+typedef int (*_do_jsoncleaner)(const char *, int) ;
+
+// Versions for this CPU, set once by _do_jsonselectinit
+
+static pthread_once_t _do_jsonselectonce = PTHREAD_ONCE_INIT ;
+static _do_jsonclassifier _do_jsonclassifierbest ;
+static _do_jsoncleaner _do_jsoncleanlenbest ;
+static void _do_jsonselectinit(void) ;
+
+#ifndef DO_JSONSIMD
+
+#define DO_SWARONES 0x0101010101010101ULL
+#define DO_SWARLOW 0x7F7F7F7F7F7F7F7FULL
+#define DO_SWARHIGH 0x8080808080808080ULL
+
+// Bit 7 of each byte of x which equals c
+
+#define _do_swareq(x, c) \
+  ( ~( ( (((x) ^ ((c)*DO_SWARONES)) & DO_SWARLOW) + DO_SWARLOW ) | ((x) ^ ((c)*DO_SWARONES)) | DO_SWARLOW ) )
+
+// Gathers bit 7 of each byte into the low 8 bits
+
+#define _do_swarbits(m) ( (((m) >> 7) * 0x0102040810204080ULL) >> 56 )
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Classifies a block, 8 bytes at a time within a 64 bit
+//        word
+// @param(in) b Block of DO_JSONBLOCK bytes
+// @param(out) m Masks
+//
+
+static void _do_jsonclassify(const unsigned char *b, IDOJSONMASKS *m)
+{
+  memset(m, '\0', sizeof(IDOJSONMASKS)) ;
+
+  for (int i=0; i<DO_JSONBLOCK; i+=8) {
+
+    uint64_t x ;
+    memcpy(&x, b+i, 8) ;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x) ;
+#endif
+    uint64_t xl = x | (0x20*DO_SWARONES) ;
+
+    uint64_t op = _do_swareq(xl, '{') | _do_swareq(xl, '}') | _do_swareq(x, ':') | _do_swareq(x, ',') ;
+
+    // Controls 9 to 13 (for bytes below 128, adding 0x80-n sets
+    // bit 7 if the byte is at least n)
+
+    uint64_t low = x & DO_SWARLOW ;
+    uint64_t ctl = (low + (0x80-9)*DO_SWARONES) & ~(low + (0x80-14)*DO_SWARONES) & ~x & DO_SWARHIGH ;
+    uint64_t space = _do_swareq(x, ' ') | ctl ;
+
+    m->quote |= _do_swarbits(_do_swareq(x, '"')) << i ;
+    m->backslash |= _do_swarbits(_do_swareq(x, '\\')) << i ;
+    m->op |= _do_swarbits(op) << i ;
+    m->space |= _do_swarbits(space) << i ;
+
+  }
+}
+
+#else
+
+///////////////////////////////////////////////////////////
+//
+// @brief Classifies a block, 16 bytes at a time with SSE2.
+//        Brackets and braces differ only in bit 5, and the
+//        whitespace controls are 9 to 13.
+// @param(in) b Block of DO_JSONBLOCK bytes
+// @param(out) m Masks
+//
+
+static void _do_jsonclassify_sse2(const unsigned char *b, IDOJSONMASKS *m)
+{
+  const __m128i quote = _mm_set1_epi8('"') ;
+  const __m128i backslash = _mm_set1_epi8('\\') ;
+  const __m128i lower = _mm_set1_epi8(0x20) ;
+  const __m128i lbrace = _mm_set1_epi8('{') ;
+  const __m128i rbrace = _mm_set1_epi8('}') ;
+  const __m128i colon = _mm_set1_epi8(':') ;
+  const __m128i comma = _mm_set1_epi8(',') ;
+  const __m128i space = _mm_set1_epi8(' ') ;
+  const __m128i tab = _mm_set1_epi8('\t') ;
+  const __m128i four = _mm_set1_epi8(4) ;
+
+  memset(m, '\0', sizeof(IDOJSONMASKS)) ;
+
+  for (int i=0; i<DO_JSONBLOCK; i+=16) {
+
+    __m128i v = _mm_loadu_si128((const __m128i *)(b+i)) ;
+    __m128i vl = _mm_or_si128(v, lower) ;
+    __m128i ctl = _mm_sub_epi8(v, tab) ;
+
+    __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(vl, lbrace), _mm_cmpeq_epi8(vl, rbrace)),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma))) ;
+    __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                              _mm_cmpeq_epi8(_mm_min_epu8(ctl, four), ctl)) ;
+
+    m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << i ;
+    m->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << i ;
+    m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << i ;
+    m->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i ;
+
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Classifies a block, 32 bytes at a time with AVX2
+// @param(in) b Block of DO_JSONBLOCK bytes
+// @param(out) m Masks
+//
+
+__attribute__((target("avx2")))
+static void _do_jsonclassify_avx2(const unsigned char *b, IDOJSONMASKS *m)
+{
+  const __m256i quote = _mm256_set1_epi8('"') ;
+  const __m256i backslash = _mm256_set1_epi8('\\') ;
+  const __m256i lower = _mm256_set1_epi8(0x20) ;
+  const __m256i lbrace = _mm256_set1_epi8('{') ;
+  const __m256i rbrace = _mm256_set1_epi8('}') ;
+  const __m256i colon = _mm256_set1_epi8(':') ;
+  const __m256i comma = _mm256_set1_epi8(',') ;
+  const __m256i space = _mm256_set1_epi8(' ') ;
+  const __m256i tab = _mm256_set1_epi8('\t') ;
+  const __m256i four = _mm256_set1_epi8(4) ;
+
+  memset(m, '\0', sizeof(IDOJSONMASKS)) ;
+
+  for (int i=0; i<DO_JSONBLOCK; i+=32) {
+
+    __m256i v = _mm256_loadu_si256((const __m256i *)(b+i)) ;
+    __m256i vl = _mm256_or_si256(v, lower) ;
+    __m256i ctl = _mm256_sub_epi8(v, tab) ;
+
+    __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(vl, lbrace), _mm256_cmpeq_epi8(vl, rbrace)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma))) ;
+    __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                 _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, four), ctl)) ;
+
+    m->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << i ;
+    m->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, backslash)) << i ;
+    m->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << i ;
+    m->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i ;
+
+  }
+}
+
+#endif
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the best block classifier for this CPU
+// @return Classifier
+//
+
+static _do_jsonclassifier _do_jsonselect(void)
+{
+  _do_jsonclassifier classify = __atomic_load_n(&_do_jsonclassifierbest, __ATOMIC_ACQUIRE) ;
+  if (!classify) {
+    pthread_once(&_do_jsonselectonce, _do_jsonselectinit) ;
+    classify = _do_jsonclassifierbest ;
+  }
+  return classify ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds the escaped characters in a block.  A character
+//        is escaped if it follows an odd length run of
+//        backslashes, so runs starting on odd and even bits are
+//        separated, and added to carry to the end of the run.
+// @param(in) backslash Backslash mask
+// @param(in/out) prevescaped True if the first character of the
+//                block is escaped, updated for the next block
+// @return Mask of escaped characters
+//
+
+static uint64_t _do_jsonescaped(uint64_t backslash, uint64_t *prevescaped)
+{
+  if (!backslash) {
+    uint64_t escaped = *prevescaped ;
+    *prevescaped = 0 ;
+    return escaped ;
+  }
+
+  backslash &= ~(*prevescaped) ;
+  uint64_t follows = (backslash << 1) | *prevescaped ;
+  uint64_t oddstarts = backslash & ~DO_EVENBITS & ~follows ;
+
+  uint64_t evenruns ;
+  *prevescaped = __builtin_add_overflow(oddstarts, backslash, &evenruns) ;
+
+  return (DO_EVENBITS ^ (evenruns << 1)) & follows ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Builds the structural index of a JSON document into
+//        ctx->jsonindex
+// @param(in) ctx Tree context
+// @param(in) json JSON text
+// @param(in) len Length of JSON text
+// @return Number of entries in the index (including the
+//         terminator), or 0 on error
+//
+
+int _do_jsonindex(IDOCONTEXT *ctx, char *json, int len)
+{
+  assert(len>=0) ;
+
+  // At most one entry per byte, plus the terminator
+
+  unsigned long int need = (unsigned long int)len + 1 ;
+  if (need > ctx->maxjsonindex) {
+    unsigned int *index = realloc(ctx->jsonindex, need * sizeof(unsigned int)) ;
+    if (!index) return 0 ;
+    ctx->jsonindex = index ;
+    ctx->maxjsonindex = need ;
+  }
+
+  _do_jsonclassifier classify = _do_jsonselect() ;
+  unsigned int *out = ctx->jsonindex ;
+  int n = 0 ;
+
+  uint64_t prevescaped = 0 ;
+  uint64_t previnstring = 0 ;
+  uint64_t prevscalar = 0 ;
+
+  for (int base=0; base<len; base+=DO_JSONBLOCK) {
+
+    const unsigned char *b = (const unsigned char *)json + base ;
+
+    // The last block is padded with spaces
+
+    unsigned char tail[DO_JSONBLOCK] ;
+    if (len-base < DO_JSONBLOCK) {
+      memset(tail, ' ', DO_JSONBLOCK) ;
+      memcpy(tail, b, len-base) ;
+      b = tail ;
+    }
+
+    IDOJSONMASKS m ;
+    classify(b, &m) ;
+
+    // Unescaped quotes open and close strings
+
+    uint64_t quote = m.quote & ~_do_jsonescaped(m.backslash, &prevescaped) ;
+
+    uint64_t instring = quote ;
+    instring ^= instring << 1 ;
+    instring ^= instring << 2 ;
+    instring ^= instring << 4 ;
+    instring ^= instring << 8 ;
+    instring ^= instring << 16 ;
+    instring ^= instring << 32 ;
+    instring ^= previnstring ;
+    previnstring = (uint64_t)((int64_t)instring >> 63) ;
+
+    // Other values start after whitespace or a structural character
+
+    uint64_t scalar = ~(m.op | m.space | m.quote | instring) ;
+    uint64_t starts = scalar & ~((scalar << 1) | prevscalar) ;
+    prevscalar = scalar >> 63 ;
+
+    uint64_t bits = (m.op & ~instring) | (quote & instring) | starts ;
+
+    while (bits) {
+      out[n++] = base + __builtin_ctzll(bits) ;
+      bits &= bits-1 ;
+    }
+
+  }
+
+  out[n++] = len ;
+
+  return n ;
+}
+
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// Output
+//
+// When a string is written as JSON, the runs of characters which
+// need no escaping ('"', '\\', '\'' and controls do) are found 16
+// or 32 bytes at a time in the same way, and copied in one go.
+//
+
+#ifndef DO_JSONSIMD
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of the run of characters which can
+//        be written into a JSON string as they are, one byte at
+//        a time
+// @param(in) s String
+// @param(in) len Length of string
+// @return Length of run
+//
+
+static int _do_jsoncleanlen_byte(const char *s, int len)
+{
+  const unsigned char *p = (const unsigned char *)s ;
+  int i = 0 ;
+  while (i<len && p[i]>=0x20 && p[i]!='"' && p[i]!='\\' && p[i]!='\'') i++ ;
+  return i ;
+}
+
+#else
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of the run of characters which can
+//        be written into a JSON string as they are, 16 bytes at
+//        a time with SSE2
+// @param(in) s String
+// @param(in) len Length of string
+// @return Length of run
+//
+
+static int _do_jsoncleanlen_sse2(const char *s, int len)
+{
+  const __m128i quote = _mm_set1_epi8('"') ;
+  const __m128i backslash = _mm_set1_epi8('\\') ;
+  const __m128i apostrophe = _mm_set1_epi8('\'') ;
+  const __m128i ctl = _mm_set1_epi8(0x1F) ;
+
+  int i = 0 ;
+
+  for (; i+16<=len; i+=16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s+i)) ;
+    __m128i e = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                             _mm_or_si128(_mm_cmpeq_epi8(v, apostrophe), _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v))) ;
+    int mask = _mm_movemask_epi8(e) ;
+    if (mask) return i + __builtin_ctz(mask) ;
+  }
+
+  const unsigned char *p = (const unsigned char *)s ;
+  while (i<len && p[i]>=0x20 && p[i]!='"' && p[i]!='\\' && p[i]!='\'') i++ ;
+  return i ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of the run of characters which can
+//        be written into a JSON string as they are, 32 bytes at
+//        a time with AVX2
+// @param(in) s String
+// @param(in) len Length of string
+// @return Length of run
+//
+
+__attribute__((target("avx2")))
+static int _do_jsoncleanlen_avx2(const char *s, int len)
+{
+  const __m256i quote = _mm256_set1_epi8('"') ;
+  const __m256i backslash = _mm256_set1_epi8('\\') ;
+  const __m256i apostrophe = _mm256_set1_epi8('\'') ;
+  const __m256i ctl = _mm256_set1_epi8(0x1F) ;
+
+  int i = 0 ;
+
+  for (; i+32<=len; i+=32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s+i)) ;
+    __m256i e = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                _mm256_or_si256(_mm256_cmpeq_epi8(v, apostrophe), _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v))) ;
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(e) ;
+    if (mask) return i + __builtin_ctz(mask) ;
+  }
+
+  return i + _do_jsoncleanlen_sse2(s+i, len-i) ;
+}
+
+#endif
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Chooses the classifier and clean run finder for this
+//        CPU.  Called once, through pthread_once, so threads
+//        parsing or writing their first documents together
+//        don't race on it.  The pointers are published with
+//        release stores, so later calls only need an acquire
+//        load rather than going through pthread_once.
+//
+
+static void _do_jsonselectinit(void)
+{
+  _do_jsonclassifier classify ;
+  _do_jsoncleaner cleanlen ;
+
+#ifdef DO_JSONSIMD
+  __builtin_cpu_init() ;
+  if (__builtin_cpu_supports("avx2")) {
+    classify = _do_jsonclassify_avx2 ;
+    cleanlen = _do_jsoncleanlen_avx2 ;
+  } else {
+    classify = _do_jsonclassify_sse2 ;
+    cleanlen = _do_jsoncleanlen_sse2 ;
+  }
+#else
+  classify = _do_jsonclassify ;
+  cleanlen = _do_jsoncleanlen_byte ;
+#endif
+
+  __atomic_store_n(&_do_jsonclassifierbest, classify, __ATOMIC_RELEASE) ;
+  __atomic_store_n(&_do_jsoncleanlenbest, cleanlen, __ATOMIC_RELEASE) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of the run of characters at the start
+//        of a string which can be written into JSON as they are
+// @param(in) s String
+// @param(in) len Length of string
+// @return Length of run (len if nothing needs escaping)
+//
+
+int _do_jsoncleanlen(const char *s, int len)
+{
+  _do_jsoncleaner cleanlen = __atomic_load_n(&_do_jsoncleanlenbest, __ATOMIC_ACQUIRE) ;
+  if (!cleanlen) {
+    pthread_once(&_do_jsonselectonce, _do_jsonselectinit) ;
+    cleanlen = _do_jsoncleanlenbest ;
+  }
+  return cleanlen(s, len) ;
+}
@@ -0,0 +1,372 @@
+//
+// dataobject_label.c
+//
+// Interned label table
+//
+// Each tree keeps a single copy of every distinct label, which
+// is shared by all of the nodes using it, so node labels can be
+// compared by pointer.  Labels are reference counted, and are
+// removed from the table when the last node using them is
+// cleared (or all at once when the root of an arena / pool tree
+// is cleared).
+//
+
+#include <malloc.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+
+#include "dataobject_private.h"
+#include "../dataobject.h"
+
+#define DO_LABELBUCKETS 64
+
+#define _do_labelentry(l) ( (IDOLABEL *)( (l) - offsetof(IDOLABEL, str) ) )
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Hashes a string (FNV-1a)
+// @param(in) s String to hash
+// @param(in) len Length of string
+// @return hash
+//
+
+unsigned int _do_hash(char *s, int len)
+{
+  unsigned int h = 2166136261U ;
+  for (int i=0; i<len; i++) {
+    h ^= (unsigned char)s[i] ;
+    h *= 16777619U ;
+  }
+  return h ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds an interned label
+// @param(in) ctx Tree context
+// @param(in) s Label to find (need not be null terminated)
+// @param(in) len Length of label
+// @return interned label, or NULL if no node in the tree uses it
+//
+
+char *_do_labelfind(IDOCONTEXT *ctx, char *s, int len)
+{
+  if (!ctx->labels) return NULL ;
+
+  return _do_labelfindhash(ctx, s, len, _do_hash(s, len)) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds an interned label, given its hash
+// @param(in) ctx Tree context
+// @param(in) s Label to find (need not be null terminated)
+// @param(in) len Length of label
+// @param(in) hash Hash of label, from _do_hash
+// @return interned label, or NULL if no node in the tree uses it
+//
+
+char *_do_labelfindhash(IDOCONTEXT *ctx, char *s, int len, unsigned int hash)
+{
+  if (!ctx->labels) return NULL ;
+
+  IDOLABEL *e = ctx->labels[hash & (ctx->nlabelbuckets-1)] ;
+
+  while (e) {
+    if (e->hash==hash && e->len==len && memcmp(e->str, s, len)==0) return e->str ;
+    e = e->next ;
+  }
+
+  return NULL ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Doubles the size of the label hash table
+// @param(in) ctx Tree context
+// @return true on success
+//
+
+static int _do_labelgrow(IDOCONTEXT *ctx)
+{
+  unsigned int nbuckets = ctx->nlabelbuckets ? ctx->nlabelbuckets*2 : DO_LABELBUCKETS ;
+
+  IDOLABEL **buckets = calloc(nbuckets, sizeof(IDOLABEL *)) ;
+  if (!buckets) return 0 ;
+
+  for (unsigned int i=0; i<ctx->nlabelbuckets; i++) {
+    IDOLABEL *e = ctx->labels[i] ;
+    while (e) {
+      IDOLABEL *next = e->next ;
+      e->next = buckets[e->hash & (nbuckets-1)] ;
+      buckets[e->hash & (nbuckets-1)] = e ;
+      e = next ;
+    }
+  }
+
+  free(ctx->labels) ;
+  ctx->labels = buckets ;
+  ctx->nlabelbuckets = nbuckets ;
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets a reference to an interned label, adding it to
+//        the table if it is not already present
+// @param(in) ctx Tree context
+// @param(in) s Label (need not be null terminated)
+// @param(in) len Length of label
+// @return interned label, or NULL on error
+//
+
+char *_do_labelintern(IDOCONTEXT *ctx, char *s, int len)
+{
+  return _do_labelinternhash(ctx, s, len, _do_hash(s, len)) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets a reference to an interned label, given its hash
+// @param(in) ctx Tree context
+// @param(in) s Label (need not be null terminated)
+// @param(in) len Length of label
+// @param(in) hash Hash of label, from _do_hash
+// @return interned label, or NULL on error
+//
+
+char *_do_labelinternhash(IDOCONTEXT *ctx, char *s, int len, unsigned int hash)
+{
+  if (ctx->nlabels >= ctx->nlabelbuckets) {
+    if (!_do_labelgrow(ctx)) return NULL ;
+  }
+
+  IDOLABEL **bucket = &(ctx->labels[hash & (ctx->nlabelbuckets-1)]) ;
+
+  for (IDOLABEL *e = *bucket; e; e = e->next) {
+    if (e->hash==hash && e->len==len && memcmp(e->str, s, len)==0) {
+      e->refs++ ;
+      return e->str ;
+    }
+  }
+
+  IDOLABEL *e = _do_alloc(ctx, sizeof(IDOLABEL) + len + 1) ;
+  if (!e) return NULL ;
+
+  e->hash = hash ;
+  e->refs = 1 ;
+  e->len = len ;
+  memcpy(e->str, s, len) ;
+  e->str[len] = '\0' ;
+
+  e->next = *bucket ;
+  *bucket = e ;
+  ctx->nlabels++ ;
+
+  return e->str ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gets an additional reference to an interned label
+// @param(in) label Interned label
+// @return label
+//
+
+char *_do_labelref(char *label)
+{
+  if (label) _do_labelentry(label)->refs++ ;
+  return label ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Releases a reference to an interned label
+// @param(in) ctx Tree context
+// @param(in) label Interned label
+//
+
+void _do_labelrelease(IDOCONTEXT *ctx, char *label)
+{
+  if (!label) return ;
+
+  IDOLABEL *e = _do_labelentry(label) ;
+  if (--(e->refs) > 0) return ;
+
+  IDOLABEL **pe = &(ctx->labels[e->hash & (ctx->nlabelbuckets-1)]) ;
+  while (*pe && *pe!=e) pe = &((*pe)->next) ;
+  assert(*pe) ;
+  if (*pe) *pe = e->next ;
+  ctx->nlabels-- ;
+
+  _do_free(ctx, e, sizeof(IDOLABEL) + e->len + 1) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the length of an interned label
+// @param(in) label Interned label
+// @return length
+//
+
+int _do_labellen(char *label)
+{
+  return label ? _do_labelentry(label)->len : 0 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Empties the label table (the labels themselves must
+//        already have been released with the tree's memory)
+// @param(in) ctx Tree context
+//
+
+void _do_labelreset(IDOCONTEXT *ctx)
+{
+  if (ctx->labels) memset(ctx->labels, '\0', ctx->nlabelbuckets * sizeof(IDOLABEL *)) ;
+  ctx->nlabels = 0 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the integer key which a label represents.
+//        Only canonical numbers (without leading zeros) are keys,
+//        so that a key and its label are interchangeable.
+// @param(in) s Label (need not be null terminated)
+// @param(in) len Length of label
+// @param(in) ispath True if s is a path component, which can be
+//            "#n" to match a key of either kind (searches fall
+//            back to the label "#n" if no key matches)
+// @return Encoded key (number<<2 | kind), or -1 if not a key
+//
+
+long int _do_labelkey(char *s, int len, int ispath)
+{
+  int kind = DO_KEY_INDEX ;
+
+  if (len>1 && s[0]=='f') {
+    kind = DO_KEY_FIELD ;
+    s++ ; len-- ;
+  } else if (len>1 && s[0]=='#' && ispath) {
+    kind = DO_KEY_ANY ;
+    s++ ; len-- ;
+  }
+
+  if (len<1 || len>9 || (s[0]=='0' && len>1)) return -1 ;
+
+  long int n = 0 ;
+  for (int i=0; i<len; i++) {
+    if (s[i]<'0' || s[i]>'9') return -1 ;
+    n = n*10 + (s[i]-'0') ;
+  }
+
+  return n<<2 | kind ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Gives a node an integer key
+// @param(in) h Node
+// @param(in) key Encoded key (DO_KEY_ANY is stored as an index)
+//
+
+void _do_setkey(IDATAOBJECT *h, long int key)
+{
+  assert(key>=0) ;
+
+  h->key = (unsigned int)(key>>2) ;
+  h->flags &= ~DO_F_FIELD ;
+  h->flags |= DO_F_KEY ;
+  if ((key&3)==DO_KEY_FIELD) h->flags |= DO_F_FIELD ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the text of a node's label, formatting it from
+//        the node's key if it has not been produced
+// @param(in) h Node
+// @param(in) tmp Buffer of at least 16 bytes for the formatted key
+// @param(out) len Set to length of label
+// @return Label (not null terminated), or NULL if none
+//
+
+char *_do_labeltext(IDATAOBJECT *h, char *tmp, int *len)
+{
+  if (h->label || !(h->flags & DO_F_KEY)) {
+    *len = _do_labellen(h->label) ;
+    return h->label ;
+  }
+
+  // Digits from the end
+
+  char *p = tmp+16 ;
+  unsigned int n = h->key ;
+  do {
+    *(--p) = '0' + n%10 ;
+    n /= 10 ;
+  } while (n) ;
+  if (h->flags & DO_F_FIELD) *(--p) = 'f' ;
+
+  *len = tmp+16-p ;
+  return p ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the interned label of a node, producing it from
+//        the node's key if necessary
+// @param(in) h Node
+// @return Label, or NULL if none / error
+//
+
+char *_do_nodelabel(IDATAOBJECT *h)
+{
+  if (h->label || !(h->flags & DO_F_KEY)) return h->label ;
+
+  char tmp[16] ;
+  int len ;
+  char *s = _do_labeltext(h, tmp, &len) ;
+
+  h->label = _do_labelintern(h->ctx, s, len) ;
+  return h->label ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Labels an (unlabelled) node, with an integer key if
+//        the label is one, otherwise with the interned label
+// @param(in) h Node
+// @param(in) s Label (need not be null terminated)
+// @param(in) len Length of label
+// @param(in) key Encoded key, from _do_labelkey(s, len)
+// @return true on success
+//
+
+int _do_labelnode(IDATAOBJECT *h, char *s, int len, long int key)
+{
+  if (key>=0) {
+    _do_setkey(h, key) ;
+    return 1 ;
+  }
+
+  h->label = _do_labelintern(h->ctx, s, len) ;
+  return h->label!=NULL ;
+}
+
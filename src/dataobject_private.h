@@ -9,42 +9,322 @@
 
 
 #define DATAOBJECT IDATAOBJECT
+#define DOPATH IDOPATH
+
+// Allocation modes for a tree context
+
+#define DO_MODE_HEAP 0   // Every node / label / buffer is a separate malloc
+#define DO_MODE_ARENA 1  // Allocated from chunks owned by the root
+#define DO_MODE_POOL 2   // As arena, but freed memory is recycled and
+                         // chunks are kept when the root is cleared
+
+// Pool free list size classes (16, 32 ... 4096 bytes)
+
+#define DO_POOLCLASSES 9
+#define DO_POOLMIN 16
+#define DO_POOLMAX (DO_POOLMIN<<(DO_POOLCLASSES-1))
+
+// Arena chunk, data follows the header
+
+typedef struct IDOCHUNK {
+  struct IDOCHUNK *next ;
+  unsigned long int size ;
+  unsigned long int used ;
+} IDOCHUNK ;
+
+// Interned label, the label string follows the header
+
+typedef struct IDOLABEL {
+  struct IDOLABEL *next ;
+  unsigned int hash ;
+  int refs ;
+  int len ;
+  char str[] ;
+} IDOLABEL ;
+
+// Node storage flags
+
+#define DO_F_INLINE 0x01   // d2 data is held in the node itself
+#define DO_F_BORROWED 0x02 // d2 points into a caller's buffer, which
+                           // is not owned, and not null terminated
+#define DO_F_HEAD 0x04     // Node is the head of a chain (the root,
+                           // or a child), so can hold its index
+#define DO_F_KEY 0x08      // Node has an integer key
+#define DO_F_FIELD 0x10    // The key is a protobuf field number
+
+// Integer keys.  Array entries and protobuf fields are identified
+// by number, and their labels ("5", "f5") are only produced when
+// asked for.  Keys are passed around encoded with their kind, as
+// (number<<2 | kind), or -1 for none.  A path component "#5"
+// matches either kind.
+
+#define DO_KEY_INDEX 0
+#define DO_KEY_FIELD 1
+#define DO_KEY_ANY 2
+#define DO_KEYMAX 999999999
+
+// Longest number written by _do_formatnumber
+
+#define DO_NUMBERMAX 32
+
+// Largest JSON structural index (in entries) kept between parses
+
+#define DO_JSONINDEXKEEP 65536
+
+// Output / temporary buffer.  Owned buffers grow geometrically.
+// Fixed (caller supplied) buffers never grow, and once full, len
+// continues to count the size which would have been required.
+// failed is set if an allocation fails, so that callers only need
+// to check once the output is complete.
+
+typedef struct IDOTMPBUF {
+  char *buf ;
+  int size ;
+  int len ;
+  int fixed ;
+  int failed ;
+} IDOTMPBUF ;
+
+// Index of a chain of siblings, held by the head of the chain
+// (see dataobject_chain.c).  Only valid if epoch matches the
+// tree's epoch.  Every index in a tree is on the tree's list of
+// chains, so the head of a chain can be found from its tail.
+
+typedef struct IDOCHAIN {
+  unsigned int epoch ;
+  int count ;
+  int unlabelled ;               // Chain has unlabelled nodes, so no hash
+  int duplicates ;               // Some label appears more than once
+  struct IDATAOBJECT *head ;
+  struct IDATAOBJECT *tail ;
+  struct IDOCHAIN *nextchain ;   // List of the tree's chains
+  struct IDOCHAIN *prevchain ;
+  unsigned int nslots ;          // Label hash (long chains only)
+  struct IDATAOBJECT **slots ;
+  int nitems ;                   // Vector of nodes (if used)
+  struct IDATAOBJECT **items ;
+} IDOCHAIN ;
 
 typedef struct IDATAOBJECT {
 
+  // Context of the tree which owns this object
+  struct IDOCONTEXT *ctx ;
+
   // Linked list of objects at this level
   struct IDATAOBJECT *next ;
 
   // Hierarchical child object
   struct IDATAOBJECT *child ;
 
-  // Data Label and type
-  // Arrays have ascii labels "0", "1" ...
+  // Index of the chain, if this is the head of a long chain
+  IDOCHAIN *chain ;
+
+  // Data Label (interned)
+  // Arrays have ascii labels "0", "1" ..., and protobuf fields
+  // "f1", "f2" ..., which may not be produced until needed (see
+  // DO_F_KEY)
   char *label ;
-  int type ;
-  int isarray ;  // Label is part of an array
 
-  // Data storage
+  // Data storage.  For strings and data, d1 is the length, and
+  // short values (including the terminating null) are stored in
+  // d2inline rather than allocated - use _do_d2() to access.
   unsigned long int d1 ;
-  char *d2 ;
+  union {
+    char *d2 ;
+    char d2inline[sizeof(char *)] ;
+  } ;
 
-  // Temporary store / output buffer
-  char *tmpbuf ;
-  int tmpbufsize ;
-  int tmpbuflen ;
+  // Type, array marker and flags, packed
+  signed int type : 8 ;
+  unsigned int isarray : 1 ;  // Children are part of an array
+  unsigned int flags : 7 ;
 
-  // JSON Parse error message
-  char *jsonparsestatus ;
+  // Integer key (array index or field number), if DO_F_KEY
+  unsigned int key ;
 
 } IDATAOBJECT ;
 
+#define _do_d2(h) ( ((h)->flags & DO_F_INLINE) ? (h)->d2inline : (h)->d2 )
+#define _do_hasd2(h) ( ((h)->flags & DO_F_INLINE) || (h)->d2 )
+#define _do_ishead(h) ( ((h)->flags & DO_F_HEAD) || (h)->chain )
+
+// Unlabelled nodes (with neither label nor key) match any label
+
+#define _do_haslabel(h) ( (h)->label || ((h)->flags & DO_F_KEY) )
+
+#define _do_nodekey(h) ( ((h)->flags & DO_F_KEY) ? \
+  ( (long int)(h)->key<<2 | (((h)->flags & DO_F_FIELD) ? DO_KEY_FIELD : DO_KEY_INDEX) ) : -1L )
+
+#define _do_keymatch(nodekey, k) ( (nodekey)>=0 && ((nodekey)>>2)==((k)>>2) && \
+  ( ((k)&3)==DO_KEY_ANY || ((nodekey)&3)==((k)&3) ) )
+
+// True if a node is an array entry, for '+'
+
+#define _do_isindex(h) ( ((h)->flags & (DO_F_KEY|DO_F_FIELD))==DO_F_KEY || \
+  ( (h)->label && isdigit((h)->label[0]) ) )
+
+// Compiled path (see docompilepath).  The component strings are
+// held in the same allocation, after the component array.
+
+typedef struct IDOPATHCOMPONENT {
+  char *str ;         // Label (null terminated)
+  int len ;           // Length of label
+  unsigned int hash ; // _do_hash of label
+  long int key ;      // Integer key (see _do_labelkey)
+} IDOPATHCOMPONENT ;
+
+typedef struct IDOPATH {
+  int ncomponents ;
+  IDOPATHCOMPONENT component[] ;
+} IDOPATH ;
+
+// Trail of the nodes found for each component of the previous
+// path searched, so that a following path with the same prefix
+// can continue from there (see _do_searchtrail)
+
+#define DO_TRAILDEPTH 32
+
+typedef struct IDOTRAIL {
+  int depth ;                         // Number of components held
+  char *str[DO_TRAILDEPTH] ;          // Component (within previous path)
+  int len[DO_TRAILDEPTH] ;            // Length of component
+  IDATAOBJECT *node[DO_TRAILDEPTH] ;  // Node found for component
+} IDOTRAIL ;
+
+// Tree context, created with (and containing) the root node
+
+typedef struct IDOCONTEXT {
+
+  // Root node of the tree
+  IDATAOBJECT root ;
+
+  // Output buffer for doasjson / doasprotobuf
+  IDOTMPBUF tmpbuf ;
+
+  // Embedded message sizes, in pre-order, from the protobuf
+  // sizing pass
+  int *pbsizes ;
+  int npbsizes ;
+  int maxpbsizes ;
+
+  // JSON Parse error message (empty if OK)
+  char jsonparsestatus[256] ;
+
+  // Allocation mode
+  int mode ;
+
+  // Arena chunks (current chunk first), and chunks kept
+  // for re-use after the root has been cleared
+  IDOCHUNK *chunks ;
+  IDOCHUNK *spare ;
+  unsigned long int sizehint ;
+  unsigned long int chunksize ;
+
+  // Pool free lists
+  IDATAOBJECT *freenodes ;
+  void *freelist[DO_POOLCLASSES] ;
+
+  // Interned label hash table
+  IDOLABEL **labels ;
+  unsigned int nlabelbuckets ;
+  unsigned int nlabels ;
+
+  // Chain indexes, which are stale if their epoch differs
+  unsigned int epoch ;
+  unsigned int nchains ;
+  IDOCHAIN *chains ;
+
+  // JSON structural index, kept for re-use by the next parse
+  // (shrunk back to DO_JSONINDEXKEEP entries after a large one,
+  // except in pooled trees)
+  unsigned int *jsonindex ;
+  unsigned long int maxjsonindex ;
+
+  // Length of the JSON document being parsed, which need not be
+  // null terminated (the index ends with an entry at this offset)
+  int jsonlen ;
+
+  // Deferred deletion: the next tree waiting to be reclaimed,
+  // and the node to resume freeing from
+  struct IDOCONTEXT *reclaimnext ;
+  IDATAOBJECT *reclaim ;
+
+} IDOCONTEXT ;
+
+// dataobject_alloc.c functions
+
+IDOCONTEXT *_do_newcontext(int mode, unsigned long int sizehint) ;
+void _do_freecontext(IDOCONTEXT *ctx) ;
+void _do_resetcontext(IDOCONTEXT *ctx) ;
+void *_do_alloc(IDOCONTEXT *ctx, unsigned long int len) ;
+void *_do_realloc(IDOCONTEXT *ctx, void *p, unsigned long int oldlen, unsigned long int newlen) ;
+void _do_free(IDOCONTEXT *ctx, void *p, unsigned long int len) ;
+char *_do_strndup(IDOCONTEXT *ctx, char *src, int len) ;
+IDATAOBJECT *_do_newnode(IDOCONTEXT *ctx) ;
+IDATAOBJECT *_do_newchild(IDATAOBJECT *parent) ;
+void _do_freenode(IDATAOBJECT *dh) ;
+
+// dataobject_label.c functions
+
+unsigned int _do_hash(char *s, int len) ;
+char *_do_labelfind(IDOCONTEXT *ctx, char *s, int len) ;
+char *_do_labelfindhash(IDOCONTEXT *ctx, char *s, int len, unsigned int hash) ;
+long int _do_labelkey(char *s, int len, int ispath) ;
+void _do_setkey(IDATAOBJECT *h, long int key) ;
+char *_do_nodelabel(IDATAOBJECT *h) ;
+char *_do_labeltext(IDATAOBJECT *h, char *tmp, int *len) ;
+int _do_labelnode(IDATAOBJECT *h, char *s, int len, long int key) ;
+char *_do_labelintern(IDOCONTEXT *ctx, char *s, int len) ;
+char *_do_labelinternhash(IDOCONTEXT *ctx, char *s, int len, unsigned int hash) ;
+char *_do_labelref(char *label) ;
+void _do_labelrelease(IDOCONTEXT *ctx, char *label) ;
+int _do_labellen(char *label) ;
+void _do_labelreset(IDOCONTEXT *ctx) ;
+
+// dataobject_jsonscan.c functions
+
+int _do_jsonindex(IDOCONTEXT *ctx, char *json, int len) ;
+int _do_jsoncleanlen(const char *s, int len) ;
+
+// dataobject_number.c functions
+
+int _do_parsenumber(char *s, int len, int *type, unsigned long int *d1) ;
+int _do_formatnumber(char *dst, int type, unsigned long int d1) ;
+
+// dataobject_chain.c functions
+
+IDATAOBJECT *_do_chainfind(IDATAOBJECT *h, char *label, long int key, int ishead, IDATAOBJECT **tail) ;
+IDOCHAIN *_do_chainindex(IDATAOBJECT *head, int wantitems) ;
+int _do_chainunique(IDATAOBJECT *head) ;
+void _do_chainadd(IDATAOBJECT *head, IDATAOBJECT *node) ;
+void _do_chainrelabel(IDATAOBJECT *head, IDATAOBJECT *node, char *label, long int key) ;
+void _do_chainfree(IDATAOBJECT *head) ;
+
 // dataobject.c functions
 
 IDATAOBJECT *_do_search(IDATAOBJECT *root, char *path, int forcecreate) ;
+IDATAOBJECT *_do_searchpath(IDATAOBJECT *root, IDOPATH *p, int forcecreate) ;
+IDATAOBJECT *_do_searchtrail(IDATAOBJECT *root, char *path, int forcecreate, IDOTRAIL *trail) ;
 int _do_set(IDATAOBJECT *dh, int type, unsigned long int ldata, char *data, int datalen, char *path) ;
-int _do_appendtmp(IDATAOBJECT *dh, char *src, int srclen) ;
-int _do_cleartmp(IDATAOBJECT *dh) ;
-int _do_clear(IDATAOBJECT *dh, int cleartop, int cleartopjsonerror) ;
+int _do_setnode(IDATAOBJECT *h, int type, unsigned long int ldata, char *data, int datalen) ;
+int _do_getuint(IDATAOBJECT *node, int type, unsigned long int *n) ;
+int _do_getsint(IDATAOBJECT *node, int type, long int *n) ;
+int _do_getreal(IDATAOBJECT *node, int type, double *data) ;
+char *_do_getdata(IDATAOBJECT *h, int type, int *datalen) ;
+int _do_setdata(IDATAOBJECT *h, char *data, int datalen) ;
+char *_do_allocdata(IDATAOBJECT *h, int datalen) ;
+int _do_truncdata(IDATAOBJECT *h, int datalen) ;
+void _do_cleardata(IDATAOBJECT *h) ;
+int _do_clear(IDATAOBJECT *dh, int cleartop) ;
+IDATAOBJECT *_do_clearnodes(IDOCONTEXT *ctx, IDATAOBJECT *dn, long int *budget) ;
+
+// dataobject_tmpbuf.c functions
+
+int _do_appendtmp(IDOCONTEXT *ctx, IDOTMPBUF *tb, char *src, int srclen) ;
+int _do_reservetmp(IDOCONTEXT *ctx, IDOTMPBUF *tb, int len) ;
+void _do_fixedtmp(IDOTMPBUF *tb, char *buf, int bufsize) ;
+void _do_resettmp(IDOTMPBUF *tb) ;
+int _do_cleartmp(IDOCONTEXT *ctx, IDOTMPBUF *tb) ;
 int _do_strtcmp(char *haystack, char *needle, char term) ;
 unsigned long int _do_signedencode(signed long int n) ;
 signed long int _do_signeddecode(unsigned long int n) ;
@@ -55,9 +335,10 @@ double _do_doubledecode(unsigned long int n) ;
 
 // dataobject_protobuf.c functions
 
-char * _do_tovarint(unsigned long int n, int *len) ;
-char * _do_tofixed32(unsigned long int n) ;
-char * _do_tofixed64(unsigned long int n) ;
+int _do_varintlen(unsigned long int n) ;
+char *_do_putvarint(char *p, unsigned long int n) ;
+char *_do_putfixed32(char *p, unsigned long int n) ;
+char *_do_putfixed64(char *p, unsigned long int n) ;
 
 int _do_fromvarint(char *buf, unsigned long int *n, int buflen) ;
 int _do_fromfixed32(char *buf, unsigned long int *n, int buflen) ;
@@ -65,7 +346,7 @@ int _do_fromfixed64(char *buf, unsigned long int *n, int buflen) ;
 
 // Expand the do_data into the protobuf object
 
-int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen) ;
+int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen, int borrow) ;
 
 
 #endif
@@ -9,10 +9,15 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <assert.h>
 
 #include "dataobject_private.h"
 #include "../dataobject.h"
 
+int _do_asprotobuf(IDATAOBJECT *dh, IDOTMPBUF *out) ;
+int _do_pbsize(IDATAOBJECT *dh) ;
+char *_do_pbwrite(IDATAOBJECT *dh, char *p, int *next) ;
+
 
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
@@ -31,44 +36,165 @@ char * doasprotobuf(IDATAOBJECT *dh, int *len)
     return 0 ;
   }
  
-  _do_cleartmp(dh) ;
+  IDOTMPBUF *out = &(dh->ctx->tmpbuf) ;
 
-  IDATAOBJECT *h = dh ;
+  _do_resettmp(out) ;
+  if (!_do_asprotobuf(dh, out)) return NULL ;
 
-  while (h) {
+  if (len) { (*len) = out->len ; } 
+  return out->buf ;
+}
 
-    // ignore any labels not in the form fXXXX
 
-    if (h->label && h->label[0]=='f') {
+///////////////////////////////////////////////////////////
+//
+// @brief Output data as Protobuf into a caller supplied buffer
+// @param[in] dh Data object handle
+// @param[out] buf Buffer to write to
+// @param[in] bufsize Size of buffer
+// @param[out] len Length of Protobuf data, which is set even
+//             if it does not fit
+// @return True on success, false if the buffer is too small
+//         or on error
+//
 
-      int fieldnum = atoi( &(h->label[1]) ) ;
+int doasprotobuf_into(IDATAOBJECT *dh, char *buf, int bufsize, int *len)
+{
+  if (!dh) {
+    fprintf(stderr, "doasprotobuf_into: called with NULL handle\n") ;
+    return 0 ;
+  }
 
-      if (h->child) {
+  IDOTMPBUF out ;
+  _do_fixedtmp(&out, buf, bufsize) ;
+
+  int ok = _do_asprotobuf(dh, &out) ;
+
+  if (len) { (*len) = out.len ; }
+  return ok && out.len <= out.size ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the size of the protobuf encoding of a tree
+// @param[in] dh Data object handle
+// @return Size in bytes, or -1 on error
+//
+
+int dosizeprotobuf(IDATAOBJECT *dh)
+{
+  if (!dh) {
+    fprintf(stderr, "dosizeprotobuf: called with NULL handle\n") ;
+    return -1 ;
+  }
 
-        // Recurse to generate child data
+  dh->ctx->npbsizes = 0 ;
+  return _do_pbsize(dh) ;
+}
 
-        int childdatalen ;
-        char *childdata = doasprotobuf(h->child, &childdatalen) ;
 
-        // Child type / header
+///////////////////////////////////////////////////////////
+//
+// @brief Appends the protobuf encoding of a chain of objects.
+//        The encoding is sized first, so that the output can be
+//        reserved once and written directly, with the length of
+//        each embedded message already known.
+// @param[in] dh Data object handle
+// @param[in] out Buffer to append to
+// @return true on success
+//
 
-        int fieldnumlen ;
-        char *fielddat = _do_tovarint( (fieldnum<<3)|2, &fieldnumlen) ;
-        _do_appendtmp(dh, fielddat, fieldnumlen) ;
+int _do_asprotobuf(IDATAOBJECT *dh, IDOTMPBUF *out)
+{
+  IDOCONTEXT *ctx = dh->ctx ;
+
+  ctx->npbsizes = 0 ;
+  int size = _do_pbsize(dh) ;
+  if (size<0) return 0 ;
+
+  if (!_do_reservetmp(ctx, out, size)) {
 
-        // Child Length
+    // Caller's buffer is too small, just report the size needed
 
-        int childlengthlen ;
-        char *childlength = _do_tovarint(childdatalen, &childlengthlen) ;
-        _do_appendtmp( dh, childlength, childlengthlen) ;
+    if (!out->fixed) return 0 ;
+    out->len += size ;
+    return 1 ;
 
-        // Finally, attach the child data
+  }
 
-        _do_appendtmp( dh, childdata, childdatalen) ;
+  // Write directly into the reserved space
 
-        // And tidy up
+  int next = 0 ;
+  char *start = &(out->buf[out->len]) ;
+  char *end = _do_pbwrite(dh, start, &next) ;
+  assert(end-start == size) ;
 
-        _do_cleartmp(h->child) ;
+  out->len += size ;
+  if (out->buf && (out->len < out->size || !out->fixed)) out->buf[out->len] = '\0' ;
+
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Returns the protobuf field number of a node
+// @param[in] h Node
+// @return Field number, or -1 if the label is not in the form fXXXX
+//
+
+static int _do_pbfield(IDATAOBJECT *h)
+{
+  if ((h->flags & (DO_F_KEY|DO_F_FIELD))==(DO_F_KEY|DO_F_FIELD)) return h->key ;
+  if (!h->label || h->label[0]!='f') return -1 ;
+  return atoi( &(h->label[1]) ) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Calculates the size of the protobuf encoding of a chain
+//        of objects.  The size of each embedded message is recorded
+//        in ctx->pbsizes in pre-order, for use by _do_pbwrite.
+// @param[in] dh Data object handle
+// @return Size in bytes, or -1 on error
+//
+
+int _do_pbsize(IDATAOBJECT *dh)
+{
+  IDOCONTEXT *ctx = dh->ctx ;
+  IDATAOBJECT *h = dh ;
+  int size = 0 ;
+
+  while (h) {
+
+    // ignore any labels not in the form fXXXX
+
+    int fieldnum = _do_pbfield(h) ;
+
+    if (fieldnum>=0) {
+
+      int keylen = _do_varintlen( (unsigned long int)fieldnum<<3 ) ;
+
+      if (h->child) {
+
+        // Reserve this message's slot before its children's
+
+        if (ctx->npbsizes >= ctx->maxpbsizes) {
+          int newmax = ctx->maxpbsizes ? ctx->maxpbsizes*2 : 64 ;
+          int *np = realloc(ctx->pbsizes, newmax * sizeof(int)) ;
+          if (!np) return -1 ;
+          ctx->pbsizes = np ;
+          ctx->maxpbsizes = newmax ;
+        }
+        int slot = ctx->npbsizes++ ;
+
+        int childlen = _do_pbsize(h->child) ;
+        if (childlen<0) return -1 ;
+        ctx->pbsizes[slot] = childlen ;
+
+        size += keylen + _do_varintlen(childlen) + childlen ;
 
       } else {
 
@@ -83,69 +209,124 @@ char * doasprotobuf(IDATAOBJECT *dh, int *len)
           case do_int64:
           case do_sint32:
           case do_sint64:
-          case do_bool: {
+          case do_bool:
 
-            int len ;
+            size += keylen + _do_varintlen(h->d1) ;
+            break ;
 
-            char *field = _do_tovarint( (fieldnum<<3)|0, &len) ;
-            _do_appendtmp(dh, field, len) ;
+          case do_sfixed64:
+          case do_fixed64:
+          case do_double:
 
-            char *varint = _do_tovarint(h->d1, &len) ;
-            _do_appendtmp(dh, varint, len) ;
+            size += keylen + 8 ;
+            break ;
 
+          case do_fixed32:
+          case do_sfixed32:
+          case do_float:
+
+            size += keylen + 4 ;
             break ;
 
-          } 
+          case do_string:
+          case do_data:
 
-          case do_sfixed64:
-          case do_fixed64:
-          case do_double: {
+            size += keylen + _do_varintlen(h->d1) + h->d1 ;
+            break ;
 
-            int len ;
+        }
 
-            char *field = _do_tovarint( (fieldnum<<3)|1, &len) ;
-            _do_appendtmp(dh, field, len) ;
+      }
 
-            char *var64 = _do_tofixed64(h->d1) ;
-            _do_appendtmp(dh, var64, 8) ;
+    }
 
-            break ;
+    // Move to next entry in chain
 
-          }
+    h = h->next ;
 
-          case do_fixed32:
-          case do_sfixed32:
-          case do_float: {
+  }
 
-            int len ;
+  return size ;
+}
 
-            char *field = _do_tovarint( (fieldnum<<3)|5, &len) ;
-            _do_appendtmp(dh, field, len) ;
 
-            char *var32 = _do_tofixed32(h->d1) ;
-            _do_appendtmp(dh, var32, 4) ;
+///////////////////////////////////////////////////////////
+//
+// @brief Writes the protobuf encoding of a chain of objects into
+//        a buffer which has already been sized by _do_pbsize
+// @param[in] dh Data object handle
+// @param[out] p Output position
+// @param[in/out] next Index of the next embedded message size
+//                in ctx->pbsizes
+// @return Output position following the data written
+//
 
-            break ;
+char *_do_pbwrite(IDATAOBJECT *dh, char *p, int *next)
+{
+  IDOCONTEXT *ctx = dh->ctx ;
+  IDATAOBJECT *h = dh ;
 
-          }
+  while (h) {
 
+    int fieldnum = _do_pbfield(h) ;
 
-          case do_string:
-          case do_data: {
+    if (fieldnum>=0) {
+
+      unsigned long int key = (unsigned long int)fieldnum<<3 ;
+
+      if (h->child) {
 
-            int len ;
+        // Child type / header and length, then the child data
 
-            char *field = _do_tovarint( (fieldnum<<3)|2, &len) ;
-            _do_appendtmp(dh, field, len) ;
+        int childlen = ctx->pbsizes[(*next)++] ;
 
-            char *length = _do_tovarint(h->d1, &len) ;
-            _do_appendtmp( dh, length, len) ;
+        p = _do_putvarint(p, key|2) ;
+        p = _do_putvarint(p, childlen) ;
+        p = _do_pbwrite(h->child, p, next) ;
 
-            _do_appendtmp( dh, h->d2, h->d1 ) ;
+      } else {
+
+        switch (h->type) {
 
+          case do_64bit:
+          case do_32bit:
+          case do_enum:
+          case do_uint32:
+          case do_uint64:
+          case do_int32: 
+          case do_int64:
+          case do_sint32:
+          case do_sint64:
+          case do_bool:
+
+            p = _do_putvarint(p, key|0) ;
+            p = _do_putvarint(p, h->d1) ;
+            break ;
+
+          case do_sfixed64:
+          case do_fixed64:
+          case do_double:
+
+            p = _do_putvarint(p, key|1) ;
+            p = _do_putfixed64(p, h->d1) ;
             break ;
 
-          }
+          case do_fixed32:
+          case do_sfixed32:
+          case do_float:
+
+            p = _do_putvarint(p, key|5) ;
+            p = _do_putfixed32(p, h->d1) ;
+            break ;
+
+          case do_string:
+          case do_data:
+
+            p = _do_putvarint(p, key|2) ;
+            p = _do_putvarint(p, h->d1) ;
+            if (h->d1) memcpy(p, _do_d2(h), h->d1) ;
+            p += h->d1 ;
+            break ;
 
         }
 
@@ -159,11 +340,7 @@ char * doasprotobuf(IDATAOBJECT *dh, int *len)
 
   }
 
-  // Terminate and return 
-
-  if (len) { (*len) = dh->tmpbuflen ; } 
-  return dh->tmpbuf ;
-
+  return p ;
 }
 
 
@@ -181,10 +358,11 @@ char * doasprotobuf(IDATAOBJECT *dh, int *len)
 // @param(out) dh Data object handle
 // @param(in) protobuf Pointer to protobuf data
 // @param(in) buflen Length of Protobuf data
+// @param(in) borrow If true, data fields point into protobuf
 // @return Length of data processed
 //
 
-int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen) 
+int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen, int borrow) 
 {
   if (!dh || !protobuf) return -1 ;
 
@@ -197,7 +375,8 @@ int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen)
   while (p<buflen) {
 
     if ( p>0 ) {
-      d->next = donew() ;
+      d->next = _do_newnode(d->ctx) ;
+      if (!d->next) goto fail ;
       d = d->next ;
     }
 
@@ -212,18 +391,14 @@ int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen)
     }
     p+=l ;
 
-    // Extract ID and type
+    // Extract ID and type.  Nodes are keyed by field number, and
+    // only labelled "fXXXX" when needed
+
+    if ((n>>3) > DO_KEYMAX) goto fail ;
     int id = n>>3 ;
     int type = n&7 ;
 
-    char f[16] ;
-    sprintf(f, "f%d", id) ;
-    d->label = malloc(strlen(f)+1) ;
-
-    if (!d->label) {
-      goto fail ;
-    }
-    strcpy(d->label, f) ;
+    _do_setkey(d, (long int)id<<2 | DO_KEY_FIELD) ;
 
     switch (type) {
 
@@ -239,15 +414,15 @@ int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen)
       d->d1 = n ;
       break ;
 
-    case 1: // Fixed32
+    case 1: // Fixed64
 
-      l = _do_fromfixed32(&protobuf[p], &n, buflen-p) ;
+      l = _do_fromfixed64(&protobuf[p], &n, buflen-p) ;
       if (l<0) { 
         goto fail ;
       }
       p+=l ;
       d->d1 = n ;
-      d->type = do_fixed32 ;
+      d->type = do_fixed64 ;
       break ;
 
     case 2: // Data
@@ -261,28 +436,30 @@ int _do_fromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen)
         printf("n (%ld) > buflen (%d) - p(%d)\n", n, buflen, p) ; 
         goto fail ;
       }
-      d->d1 = n ;
       d->type = do_data ;
-      d->d2 = malloc(n+1) ;
-      if (!d->d2) {
+      if (borrow) {
+        // Reference the source buffer directly
+        _do_cleardata(d) ;
+        d->d2 = &protobuf[p] ;
+        d->d1 = n ;
+        d->flags |= DO_F_BORROWED ;
+      } else if (!_do_setdata(d, &protobuf[p], n)) {
+        // Null attached, but not included in d->d1
         printf("d->d2 = malloc(%d)\n", (int)n+1) ;
         goto fail ;
       }
-      memcpy(d->d2, &protobuf[p], n) ;
-      // Null attached, but not included in d->d1
-      d->d2[n]='\0' ;
       p+=n ;
       break ;
 
-    case 5: // Fixed64
+    case 5: // Fixed32
 
-      l = _do_fromfixed64(&protobuf[p], &n, buflen-p) ;
+      l = _do_fromfixed32(&protobuf[p], &n, buflen-p) ;
       if (l<0) { 
         goto fail ;
       }
       p+=l ;
       d->d1 = n ;
-      d->type = do_fixed64 ;
+      d->type = do_fixed32 ;
       break ;
 
     default: // Not supported
@@ -303,7 +480,7 @@ fail:
 int dofromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen) 
 {
   doclear(dh) ;
-  int r = _do_fromprotobuf(dh, protobuf, buflen) ;
+  int r = _do_fromprotobuf(dh, protobuf, buflen, 0) ;
   if (r>=0) {
     return 1 ;
   } else {
@@ -312,6 +489,30 @@ int dofromprotobuf(IDATAOBJECT *dh, char *protobuf, int buflen)
   }
 }
 
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Builds data object from protobuf source without
+//        copying length delimited fields
+// @param[in] dh Data object handle
+// @param[in] protobuf Protobuf data, which must outlive the tree
+// @param[out] buflen Length of Protobuf data
+// @return true on success
+//
+
+int dofromprotobuf_borrow(IDATAOBJECT *dh, char *protobuf, int buflen) 
+{
+  doclear(dh) ;
+  int r = _do_fromprotobuf(dh, protobuf, buflen, 1) ;
+  if (r>=0) {
+    return 1 ;
+  } else {
+    fprintf(stderr, "dofromprotobuf_borrow: error decoding\n") ;
+    return 0 ;
+  }
+}
+
 ///////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////
 //
@@ -327,16 +528,20 @@ int doexpandfromprotobuf(IDATAOBJECT *root, char *path)
   if (!node) return 0 ;
   if (node->child) return 0 ;
   if (node->type!=do_data && node->type!=do_string) return 0 ;
-  if (!node->d2) return 0 ;
-  node->child = donew() ;
-  if (!node->child) return 0 ;
-  if (!dofromprotobuf(node->child, node->d2, node->d1)) {
-    dodelete(node->child) ;
+  if (!_do_hasd2(node)) return 0 ;
+  if (!_do_newchild(node)) return 0 ;
+
+  // Borrowed data is expanded in place, so the children
+  // reference the original buffer too
+
+  int borrow = (node->flags & DO_F_BORROWED) ;
+  if (_do_fromprotobuf(node->child, _do_d2(node), node->d1, borrow) < 0) {
+    fprintf(stderr, "doexpandfromprotobuf: error decoding\n") ;
+    _do_clear(node->child, 1) ;
     node->child=NULL ;
     return 0 ;
   } else {
-    free(node->d2) ;
-    node->d2=NULL ;
+    _do_cleardata(node) ;
     node->d1=0 ;
     node->type=do_node ;
    return 1 ;
@@ -353,129 +558,143 @@ int doexpandfromprotobuf(IDATAOBJECT *root, char *path)
 //
 //
 
+///////////////////////////////////////////////////////////
+//
+// @brief Decodes a varint
+// @param(in) buf Data to decode
+// @param(out) n Decoded integer
+// @param(in) buflen Length of data available
+// @return Length of varint, or -1 if it is truncated or too long
+//
+
 int _do_fromvarint(char *buf, unsigned long int *n, int buflen)
 {
-  if (buflen<=0 || !buf || !n) return 0 ;
-
-  int i=0 ;
-  (*n)=0 ;
-  int shift=0 ;
-  int done=0 ;
+  if (buflen<=0 || !buf || !n) return -1 ;
 
-  do {
-    (*n) = (*n) | ((unsigned long int)(buf[i] & 0x7F))<<shift ;
-    done = !(buf[i]&0x80) ;
-    shift+=7 ;
-    i++ ;
+  unsigned long int v=0 ;
+  int max = (buflen<10) ? buflen : 10 ;
 
-  } while (i<buflen && !done) ;
+  for (int i=0; i<max; i++) {
+    unsigned char b = buf[i] ;
+    v |= (unsigned long int)(b & 0x7F) << (7*i) ;
+    if (!(b & 0x80)) {
+      (*n) = v ;
+      return i+1 ;
+    }
+  }
 
-  return i ;
+  return -1 ;
 }
 
+
+///////////////////////////////////////////////////////////
+//
+// @brief Decodes a little endian fixed32
+// @param(in) buf Data to decode
+// @param(out) n Decoded integer
+// @param(in) buflen Length of data available
+// @return 4, or -1 if it is truncated
+//
+
 int _do_fromfixed32(char *buf, unsigned long int *n, int buflen) 
 {
   if (buflen<4) return -1 ;
 
-  int i=0 ;
-  (*n)=0 ;
-
-  for (i=0; i<4; i++) {
-    (*n) = ((*n)<<8) | buf[i] ;
-  }
+  unsigned char *b = (unsigned char *)buf ;
+  (*n) = (unsigned long int)b[0] | (unsigned long int)b[1]<<8 |
+         (unsigned long int)b[2]<<16 | (unsigned long int)b[3]<<24 ;
 
   return 4 ;
 }
 
+
+///////////////////////////////////////////////////////////
+//
+// @brief Decodes a little endian fixed64
+// @param(in) buf Data to decode
+// @param(out) n Decoded integer
+// @param(in) buflen Length of data available
+// @return 8, or -1 if it is truncated
+//
+
 int _do_fromfixed64(char *buf, unsigned long int *n, int buflen) 
 {
   if (buflen<8) return -1 ;
 
-  int i=0 ;
-  (*n)=0 ;
-
-  for (i=0; i<8; i++) {
-    (*n) = ((*n)<<8) | buf[i] ;
-  }
+  unsigned long int lo, hi ;
+  _do_fromfixed32(buf, &lo, 4) ;
+  _do_fromfixed32(buf+4, &hi, 4) ;
+  (*n) = lo | hi<<32 ;
 
   return 8 ;
 }
 
 
-
-
 ///////////////////////////////////////////////////////////
 //
-// @brief Converts an integer to a varint
-// @param(in) n Integer to convert
-// @param(in) len Pointer to length
-// @return Pointer to varint result of length (len)
+// @brief Returns the length of the varint encoding of an integer
+// @param(in) n Integer
+// @return Length in bytes (1 to 10)
 //
 
-char * _do_tovarint(unsigned long int n, int *len)
+int _do_varintlen(unsigned long int n)
 {
-  static char varint[8] ;
-
-  if      ( ! (n & 0xFFFFFFFFFFFFFF80 ) ) { (*len)=1 ; }
-  else if ( ! (n & 0xFFFFFFFFFFFFC000 ) ) { (*len)=2 ; }
-  else if ( ! (n & 0xFFFFFFFFFFE00000 ) ) { (*len)=3 ; }
-  else if ( ! (n & 0xFFFFFFFFF0000000 ) ) { (*len)=4 ; }
-  else if ( ! (n & 0xFFFFFFF800000000 ) ) { (*len)=5 ; }
-  else if ( ! (n & 0xFFFFFC0000000000 ) ) { (*len)=6 ; }
-  else if ( ! (n & 0xFFFE000000000000 ) ) { (*len)=7 ; }
-  else if ( ! (n & 0xFF00000000000000 ) ) { (*len)=7 ; }
-  else { (*len)=8 ; }
-
-
-  for ( int i=0 ; i < (*len) ; i++ ) { 
-    varint[i] = (n&0x7F) | ((i<(*len)-1)?0x80:0x00) ;
-    n = (n>>7) ;
-  }
-
-  return varint ;
+  // Significant bits (at least 1), 7 per byte
 
+  int bits = 64 - __builtin_clzl(n|1) ;
+  return (bits+6)/7 ;
 }
 
 
 ///////////////////////////////////////////////////////////
 //
-// @brief Converts an integer to a fixed 64 string
-// @param(in) n Integer to convert
-// @param(in) len Pointer to length
-// @return Pointer to fixed64 of length 8
+// @brief Writes an integer as a varint
+// @param(out) p Output position, with room for _do_varintlen(n) bytes
+// @param(in) n Integer to write
+// @return Output position following the varint
 //
 
-char * _do_tofixed64(unsigned long int n)
+char *_do_putvarint(char *p, unsigned long int n)
 {
-  static char fixed64[8] ;
-
-  for ( int i=0 ; i < 8 ; i-- ) { 
-    fixed64[8-i] = (n&0xFF) ;
-    n = (n>>8) ;
+  while (n >= 0x80) {
+    *(p++) = (char)(n | 0x80) ;
+    n >>= 7 ;
   }
-
-  return fixed64 ;
+  *(p++) = (char)n ;
+  return p ;
 }
 
 
 ///////////////////////////////////////////////////////////
 //
-// @brief Converts an integer to a fixed 32 string
-// @param(in) n Integer to convert
-// @param(in) len Pointer to length
-// @return Pointer to fixed32 result of length 4
+// @brief Writes an integer as a little endian fixed32
+// @param(out) p Output position, with room for 4 bytes
+// @param(in) n Integer to write
+// @return Output position following the data
 //
 
-char * _do_tofixed32(unsigned long int n)
+char *_do_putfixed32(char *p, unsigned long int n)
 {
-  static char fixed32[4] ;
+  p[0] = (char)n ;
+  p[1] = (char)(n>>8) ;
+  p[2] = (char)(n>>16) ;
+  p[3] = (char)(n>>24) ;
+  return p+4 ;
+}
 
-  for ( int i=0 ; i < 4 ; i-- ) { 
-    fixed32[4-i] = (n&0xFF) ;
-    n = (n>>8) ;
-  }
 
-  return fixed32 ;
+///////////////////////////////////////////////////////////
+//
+// @brief Writes an integer as a little endian fixed64
+// @param(out) p Output position, with room for 8 bytes
+// @param(in) n Integer to write
+// @return Output position following the data
+//
+
+char *_do_putfixed64(char *p, unsigned long int n)
+{
+  _do_putfixed32(p, n) ;
+  return _do_putfixed32(p+4, n>>32) ;
 }
 
 
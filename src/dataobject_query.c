@@ -0,0 +1,306 @@
+//
+// dataobject_query.c
+//
+// Wildcard queries
+//
+// A query is a path in which a component can be '*', matching
+// every entry at that level, or '**', matching any number of
+// levels (a trailing '**' matches everything beneath).  The tree
+// is walked once, following only the chains which can match, and
+// literal components are looked up through the chain index, so
+// no path strings are built.  Each matching node is passed to the
+// caller's callback, which can stop the query.
+//
+// A literal component matches every entry with that label (or
+// key), as labels can repeat (e.g. repeated protobuf fields).  The
+// chain index records whether a chain has any repeated labels, so
+// the rest of an indexed chain is only walked when it does.
+//
+// With more than one '**', a node can be reached in more than one
+// way (e.g. a/a/b by '/**/a/**/b'), so the nodes already reported
+// are held in a hash set, and reported only once.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+
+#include "dataobject_private.h"
+#include "../dataobject.h"
+
+
+typedef struct IDOQUERY {
+  IDOPATH *p ;                  // Compiled pattern
+  doquery_callback callback ;
+  void *ctx ;                   // Caller's context
+  int count ;                   // Matches so far
+  int stop ;                    // Set when the callback stops the query
+  int failed ;                  // Set if memory runs out
+  int dedup ;                   // Set if matches can repeat
+  IDATAOBJECT **seen ;          // Matches so far (if dedup)
+  unsigned int nseen ;
+  unsigned int seensize ;
+} IDOQUERY ;
+
+
+#define _do_seenslot(node, mask) \
+  ( (unsigned int)( ((uintptr_t)(node) >> 6) * 0x9E3779B97F4A7C15ULL >> 32 ) & (mask) )
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Adds a node to the set of matches already reported
+// @param(in) q Query
+// @param(in) node Matching node
+// @return True if the node was not already in the set
+//
+
+static int _do_queryseen(IDOQUERY *q, IDATAOBJECT *node)
+{
+  if ((q->nseen+1)*2 > q->seensize) {
+
+    // Grow (and rehash)
+
+    unsigned int size = q->seensize ? q->seensize*2 : 64 ;
+    IDATAOBJECT **seen = calloc(size, sizeof(IDATAOBJECT *)) ;
+    if (!seen) {
+      q->failed = 1 ;
+      q->stop = 1 ;
+      return 0 ;
+    }
+    for (unsigned int i=0; i<q->seensize; i++) {
+      if (!q->seen[i]) continue ;
+      unsigned int j = _do_seenslot(q->seen[i], size-1) ;
+      while (seen[j]) j = (j+1) & (size-1) ;
+      seen[j] = q->seen[i] ;
+    }
+    free(q->seen) ;
+    q->seen = seen ;
+    q->seensize = size ;
+
+  }
+
+  unsigned int mask = q->seensize-1 ;
+  unsigned int i = _do_seenslot(node, mask) ;
+
+  while (q->seen[i]) {
+    if (q->seen[i]==node) return 0 ;
+    i = (i+1) & mask ;
+  }
+
+  q->seen[i] = node ;
+  q->nseen++ ;
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Reports a matching node to the callback
+// @param(in) q Query
+// @param(in) node Matching node
+//
+
+static void _do_querymatch(IDOQUERY *q, IDATAOBJECT *node)
+{
+  if (q->dedup && !_do_queryseen(q, node)) return ;
+  q->count++ ;
+  if (q->callback && q->callback(node, q->ctx)) q->stop = 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Reports every node in a chain, and beneath it
+// @param(in) q Query
+// @param(in) head Start of chain
+//
+
+static void _do_queryall(IDOQUERY *q, IDATAOBJECT *head)
+{
+  for (IDATAOBJECT *n = head; n && !q->stop; n = n->next) {
+    if (!_do_haslabel(n)) continue ;
+    _do_querymatch(q, n) ;
+    if (n->child) _do_queryall(q, n->child) ;
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds the next node in a chain with a label or key
+// @param(in) n Node to start from
+// @param(in) label Interned label
+// @param(in) key Encoded key, which is matched instead of label
+//            if not -1
+// @return Matching node, or NULL
+//
+
+static IDATAOBJECT *_do_querynext(IDATAOBJECT *n, char *label, long int key)
+{
+  for (; n; n = n->next) {
+    if (key>=0 ? _do_keymatch(_do_nodekey(n), key) : (label && n->label==label)) return n ;
+  }
+  return NULL ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Reports a node matching the last component, or carries
+//        on matching beneath it
+// @param(in) q Query
+// @param(in) n Node matching component i
+// @param(in) i Index of the pattern component
+//
+
+static void _do_querychain(IDOQUERY *q, IDATAOBJECT *head, int ishead, int i) ;
+
+static void _do_querystep(IDOQUERY *q, IDATAOBJECT *n, int i)
+{
+  if (i==q->p->ncomponents-1) _do_querymatch(q, n) ;
+  else if (n->child) _do_querychain(q, n->child, 1, i+1) ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Matches pattern components against a chain
+// @param(in) q Query
+// @param(in) head Start of chain
+// @param(in) ishead True if head is known to be the head of the chain
+// @param(in) i Index of pattern component to match
+//
+
+static void _do_querychain(IDOQUERY *q, IDATAOBJECT *head, int ishead, int i)
+{
+  IDOPATHCOMPONENT *pc = &(q->p->component[i]) ;
+  int last = (i==q->p->ncomponents-1) ;
+
+  if (pc->len==2 && pc->str[0]=='*' && pc->str[1]=='*') {
+
+    // Any number of levels
+
+    if (last) {
+      _do_queryall(q, head) ;
+      return ;
+    }
+
+    _do_querychain(q, head, ishead, i+1) ;
+
+    for (IDATAOBJECT *n = head; n && !q->stop; n = n->next) {
+      if (_do_haslabel(n) && n->child) _do_querychain(q, n->child, 1, i) ;
+    }
+
+  } else if (pc->len==1 && pc->str[0]=='*') {
+
+    // Every entry
+
+    for (IDATAOBJECT *n = head; n && !q->stop; n = n->next) {
+      if (_do_haslabel(n)) _do_querystep(q, n, i) ;
+    }
+
+  } else {
+
+    // Labelled entries (which can't be present if no node in the
+    // tree has the label), or keys
+
+    char *label = (pc->key<0) ? _do_labelfindhash(head->ctx, pc->str, pc->len, pc->hash) : NULL ;
+    int plus = (pc->len==1 && pc->str[0]=='+') ;
+    if (!label && pc->key<0 && !plus) return ;
+
+    IDATAOBJECT *tail = NULL ;
+    long int key = pc->key ;
+    IDATAOBJECT *n = _do_chainfind(head, label, key, ishead, &tail) ;
+
+    if (n && !_do_haslabel(n)) {
+
+      // Unlabelled nodes match anything in a search, but not here
+
+      n = _do_querynext(n, label, key) ;
+
+    } else if (!n && plus && _do_isindex(tail)) {
+
+      // '+' is the last entry of an array
+
+      _do_querystep(q, tail, i) ;
+      return ;
+
+    }
+
+    if (!n && key>=0 && (key&3)==DO_KEY_ANY) {
+
+      // "#n" is a literal label if no entry has that number
+
+      label = _do_labelfindhash(head->ctx, pc->str, pc->len, pc->hash) ;
+      key = -1 ;
+      n = label ? _do_querynext(head, label, key) : NULL ;
+
+    }
+
+    // Every entry with the label, unless the chain's index shows
+    // that labels are not repeated
+
+    int unique = ishead && _do_chainunique(head) ;
+    if (n && !unique) n = _do_querynext(head, label, key) ;
+
+    while (n && !q->stop) {
+      _do_querystep(q, n, i) ;
+      n = unique ? NULL : _do_querynext(n->next, label, key) ;
+    }
+
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Finds the nodes matching a wildcard pattern
+// @param(in) dh DATAOBJECT handle
+// @param(in) pattern Path, in which components can be '*' or '**'
+// @param(in) callback Called for each match (may be NULL)
+// @param(in) ctx Passed to callback
+// @return Number of matches, or -1 on error
+//
+
+int doquery(IDATAOBJECT *dh, char *pattern, doquery_callback callback, void *ctx)
+{
+  if (!dh || !pattern) {
+    fprintf(stderr, "doquery: called with NULL handle\n") ;
+    return -1 ;
+  }
+
+  IDOQUERY q ;
+  memset(&q, '\0', sizeof(IDOQUERY)) ;
+  q.callback = callback ;
+  q.ctx = ctx ;
+
+  q.p = docompilepath(pattern) ;
+  if (!q.p) return -1 ;
+
+  // Matches can only repeat with more than one '**'
+
+  int ndeep = 0 ;
+  for (int i=0; i<q.p->ncomponents; i++) {
+    if (q.p->component[i].len==2 && q.p->component[i].str[0]=='*' && q.p->component[i].str[1]=='*') ndeep++ ;
+  }
+  q.dedup = (ndeep>1) ;
+
+  _do_querychain(&q, dh, _do_ishead(dh), 0) ;
+
+  free(q.seen) ;
+  dofreepath(q.p) ;
+
+  if (q.failed) {
+    fprintf(stderr, "doquery: out of memory\n") ;
+    return -1 ;
+  }
+
+  return q.count ;
+}
+
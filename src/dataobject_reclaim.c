@@ -0,0 +1,162 @@
+//
+// dataobject_reclaim.c
+//
+// Deferred deletion
+//
+// Deleting a large heap tree frees every node, which takes time
+// in proportion to its size.  dodelete_async instead detaches the
+// tree and queues it, and doreclaim_step frees a limited number
+// of nodes from the queued trees each time it is called, so the
+// cost can be spread over idle time, or moved to another thread.
+// Arena and pool trees are freed a chunk at a time.
+//
+// The queue is shared by every tree, and protected by a mutex.
+// Each call to doreclaim_step takes the tree at the front of the
+// queue for itself while it works on it, so several threads can
+// reclaim at once.
+//
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+#include "dataobject_private.h"
+#include "../dataobject.h"
+
+
+static pthread_mutex_t _do_reclaimlock = PTHREAD_MUTEX_INITIALIZER ;
+static IDOCONTEXT *_do_reclaimhead = NULL ;
+static IDOCONTEXT *_do_reclaimtail = NULL ;
+static int _do_reclaimcount = 0 ;
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Frees part of a detached tree
+// @param(in) ctx Tree context
+// @param(in) budget Maximum number of nodes (or chunks) to free,
+//            which is reduced by the number freed
+// @return True if the tree (and its context) has been freed
+//
+
+static int _do_reclaimtree(IDOCONTEXT *ctx, long int *budget)
+{
+  if (ctx->reclaim) {
+    ctx->reclaim = _do_clearnodes(ctx, ctx->reclaim, budget) ;
+    if (ctx->reclaim) return 0 ;
+  }
+
+  // Arena and pool chunks
+
+  while (ctx->chunks || ctx->spare) {
+    if (*budget<=0) return 0 ;
+    IDOCHUNK **pc = ctx->chunks ? &(ctx->chunks) : &(ctx->spare) ;
+    IDOCHUNK *c = *pc ;
+    *pc = c->next ;
+    free(c) ;
+    (*budget)-- ;
+  }
+
+  _do_freecontext(ctx) ;
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Deletes a tree without freeing it immediately
+// @param(in) dh Root of the tree
+// @return True on success
+//
+
+int dodelete_async(IDATAOBJECT *dh)
+{
+  if (!dh) {
+    fprintf(stderr, "dodelete_async: called with NULL handle\n") ;
+    return 0 ;
+  }
+
+  IDOCONTEXT *ctx = dh->ctx ;
+
+  // Only whole trees can be detached
+
+  if (dh!=&ctx->root) return dodelete(dh) ;
+
+  _do_cleartmp(ctx, &(ctx->tmpbuf)) ;
+
+  // Arena and pool nodes don't need to be visited
+
+  ctx->reclaim = (ctx->mode==DO_MODE_HEAP) ? dh : NULL ;
+  ctx->reclaimnext = NULL ;
+
+  pthread_mutex_lock(&_do_reclaimlock) ;
+  if (_do_reclaimtail) _do_reclaimtail->reclaimnext = ctx ;
+  else _do_reclaimhead = ctx ;
+  _do_reclaimtail = ctx ;
+  _do_reclaimcount++ ;
+  pthread_mutex_unlock(&_do_reclaimlock) ;
+
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////
+//
+// @brief Frees part of the trees deleted with dodelete_async
+// @param(in) budget Maximum number of nodes to free, or 0 to
+//            free everything
+// @return Number of trees still waiting to be freed
+//
+
+int doreclaim_step(long int budget)
+{
+  long int remaining = (budget>0) ? budget : -1 ;
+  int count ;
+
+  pthread_mutex_lock(&_do_reclaimlock) ;
+
+  while (_do_reclaimhead && remaining!=0) {
+
+    // Take the tree at the front of the queue
+
+    IDOCONTEXT *ctx = _do_reclaimhead ;
+    _do_reclaimhead = ctx->reclaimnext ;
+    if (!_do_reclaimhead) _do_reclaimtail = NULL ;
+    pthread_mutex_unlock(&_do_reclaimlock) ;
+
+    int done ;
+    if (remaining<0) {
+      long int all = LONG_MAX ;
+      done = _do_reclaimtree(ctx, &all) ;
+      assert(done) ;
+    } else {
+      done = _do_reclaimtree(ctx, &remaining) ;
+    }
+
+    pthread_mutex_lock(&_do_reclaimlock) ;
+
+    if (done) {
+      _do_reclaimcount-- ;
+    } else {
+
+      // Put it back at the front, to carry on from next time
+
+      ctx->reclaimnext = _do_reclaimhead ;
+      _do_reclaimhead = ctx ;
+      if (!_do_reclaimtail) _do_reclaimtail = ctx ;
+
+    }
+  }
+
+  count = _do_reclaimcount ;
+  pthread_mutex_unlock(&_do_reclaimlock) ;
+
+  return count ;
+}
+
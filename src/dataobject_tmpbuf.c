@@ -1,8 +1,14 @@
 //
 // dataobject_tmpbuf.c
 //
-// This function manages the tmpbuf
+// These functions manage the output / tmp buffers
 //
+// A tree's own buffer is kept between calls, and grows
+// geometrically, so repeated output of similar sized data
+// does not allocate.  Output can also be directed into a
+// fixed, caller supplied buffer, in which case nothing is
+// allocated, and the size required is still calculated
+// when the buffer is too small.
 //
 
 
@@ -14,69 +20,136 @@
 #include "dataobject_private.h"
 #include "../dataobject.h"
 
+#define DO_TMPMIN 256
+
 
 ///////////////////////////////////////////////////////////
 //
-// @brief Append data to tmp data buffer allocating as required
-// @param(in) dh Handle of data object
-// @param(in) src Data to append
-// @param(in) srclen Length of data to append
-// @return true on success
+// @brief Ensures that a buffer has room for len more bytes
+//        (plus a null terminator)
+// @param(in) ctx Context of tree which owns the buffer
+// @param(in) tb Buffer to extend
+// @param(in) len Number of bytes which are to be appended
+// @return true on success, false if allocation fails or a
+//         fixed buffer is too small
 //
 
-int _do_appendtmp(IDATAOBJECT *dh, char *src, int srclen)
+int _do_reservetmp(IDOCONTEXT *ctx, IDOTMPBUF *tb, int len)
 {
-  static int alloclen = 128;
-
-  if (!dh) {
-    assert(dh) ;
+  if (!ctx || !tb) {
+    assert(ctx) ;
+    assert(tb) ;
     return 0 ;
   }
 
-  // Resize buffer if necessary
+  int needed = tb->len + len ;
+  if (needed <= tb->size) return 1 ;
+  if (tb->fixed) return 0 ;
+
+  // Double the buffer (at least), so the number of
+  // reallocations is logarithmic in the output size
+
+  int newsize = tb->size ? tb->size : DO_TMPMIN ;
+  while (newsize < needed) newsize *= 2 ;
+
+  char *np = _do_realloc( ctx, tb->buf, tb->buf ? tb->size + 1 : 0, newsize + 1 ) ;
+  if (!np) { return 0 ; }
+
+  tb->buf = np ;
+  tb->size = newsize ;
+
+  return 1 ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Append data to tmp data buffer allocating as required
+// @param(in) ctx Context of tree which owns the buffer
+// @param(in) tb Buffer to append to
+// @param(in) src Data to append
+// @param(in) srclen Length of data to append
+// @return true on success (a full fixed buffer is not an
+//         error, as the required length is still counted)
+//
+
+int _do_appendtmp(IDOCONTEXT *ctx, IDOTMPBUF *tb, char *src, int srclen)
+{
+  if (!_do_reservetmp(ctx, tb, srclen)) {
 
-  if ( (dh->tmpbuflen + srclen) > dh->tmpbufsize ) {
+    if (!tb) return 0 ;
+    if (!tb->fixed) {
+      tb->failed = 1 ;
+      return 0 ;
+    }
 
-    // Calculate newsize (srclen+1) to allow for null termination
-    int newsize = dh->tmpbufsize + ( 1 + srclen/alloclen ) * alloclen  ;
+    // Fixed buffer overflowed, just count
 
-    char *np = realloc( dh->tmpbuf, newsize + 1 ) ;
-    if (!np) { return 0 ; }
-    
-    dh->tmpbuf = np ; 
-    dh->tmpbufsize = newsize ;
+    tb->len += srclen ;
+    return 1 ;
 
   }
 
   // Transfer data and null terminate
 
-  memcpy( &(dh->tmpbuf[dh->tmpbuflen]), src, srclen) ;
-  dh->tmpbuflen += srclen ;
-  dh->tmpbuf[dh->tmpbuflen] = '\0' ;
+  if (srclen>0) memcpy( &(tb->buf[tb->len]), src, srclen) ;
+  tb->len += srclen ;
+  if (!tb->fixed || tb->len < tb->size) tb->buf[tb->len] = '\0' ;
 
   return 1 ;
 }
 
 
+///////////////////////////////////////////////////////////
+//
+// @brief Empties a buffer, keeping its memory for re-use
+// @param(in) tb Buffer to empty
+//
+
+void _do_resettmp(IDOTMPBUF *tb)
+{
+  if (!tb) return ;
+  tb->len = 0 ;
+  tb->failed = 0 ;
+  if (tb->buf && tb->size) tb->buf[0] = '\0' ;
+}
+
+
+///////////////////////////////////////////////////////////
+//
+// @brief Sets up a buffer to write into caller supplied memory
+// @param(out) tb Buffer to set up
+// @param(in) buf Caller's memory
+// @param(in) bufsize Size of caller's memory
+//
+
+void _do_fixedtmp(IDOTMPBUF *tb, char *buf, int bufsize)
+{
+  tb->buf = buf ;
+  tb->size = (buf && bufsize>0) ? bufsize : 0 ;
+  tb->len = 0 ;
+  tb->fixed = 1 ;
+  tb->failed = 0 ;
+}
+
+
 ///////////////////////////////////////////////////////////
 //
 // @brief Cleares / releases tmp data
-// @param(in) dh Handle of data object
+// @param(in) ctx Context of tree which owns the buffer
+// @param(in) tb Buffer to release
 // @return true on success
 //
 
-int _do_cleartmp(IDATAOBJECT *dh)
+int _do_cleartmp(IDOCONTEXT *ctx, IDOTMPBUF *tb)
 {
-  if (!dh) return 0 ;
-  IDATAOBJECT *h = dh ;
-  do {
-    if (h->tmpbuf) free(h->tmpbuf) ;
-    h->tmpbuf=NULL ;
-    h->tmpbufsize=0 ;
-    h->tmpbuflen=0 ;
-    h=h->next ;
-  } while (h) ;
+  if (!ctx || !tb) return 0 ;
+  if (tb->buf && !tb->fixed) _do_free(ctx, tb->buf, tb->size + 1) ;
+  tb->buf=NULL ;
+  tb->size=0 ;
+  tb->len=0 ;
+  tb->fixed=0 ;
+  tb->failed=0 ;
   return 1 ;
 }
 
-